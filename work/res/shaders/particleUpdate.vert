@@ -0,0 +1,32 @@
+#version 130
+
+// Advances each particle by one step. Runs with rasterization disabled and the
+// outputs captured by transform feedback into the next position and velocity buffers
+
+uniform float maxVel;
+uniform float radius;
+uniform float damping;
+
+in vec3 position;
+in vec3 velocity;
+in vec3 acceleration;
+
+out vec3 nextPosition;
+out vec3 nextVelocity;
+
+void main() {
+  vec3 vel = clamp(velocity + acceleration, -maxVel, maxVel);
+  vec3 pos = position + vel;
+
+  // Bounce off of the floor plane, reflecting and damping the velocity and
+  // placing the particle back on the floor so that it can come to rest
+  float below = 1.0 - step(0.0, pos.y - radius);
+  vel *= mix(1.0, damping, below);
+  vel.y *= mix(1.0, -1.0, below);
+  pos.y = max(pos.y, radius);
+
+  nextPosition = pos;
+  nextVelocity = vel;
+
+  gl_Position = vec4(pos, 1.0);
+}
@@ -4,11 +4,15 @@
 uniform sampler2D texture0;
 uniform bool useTexture;
 uniform bool useLighting;
+uniform int particleMode;
+uniform float particleRadius;
 
 // Values passed in from the vertex shader
 varying vec2 vTextureCoord0;
 varying vec3 n;
 varying vec3 v;
+varying vec4 vInstanceColour;
+varying vec3 vSphereCentre;
 
 // Method for determining if fragment within spotlight
 bool withinSpotlight(int, vec3, float);
@@ -16,6 +20,46 @@ bool withinSpotlight(int, vec3, float);
 void main() {
 	vec4 finalColor = vec4(0, 0, 0, 0);
 
+  // Instanced particles carry their own colour
+  vec4 ambientMaterial = particleMode > 0 ? vInstanceColour : gl_FrontMaterial.ambient;
+  vec4 diffuseMaterial = particleMode > 0 ? vInstanceColour : gl_FrontMaterial.diffuse;
+
+  // Point sprites are shaded as a hemisphere facing the viewer
+  vec3 normal = n;
+  vec3 position = v;
+
+  // Only the impostor variant of the program writes depth, since writing it at all turns
+  // off early depth testing for everything drawn with the program
+#ifdef IMPOSTORS
+  gl_FragDepth = gl_FragCoord.z;
+#endif
+
+  if (particleMode == 2) {
+    vec2 coord = gl_PointCoord * 2.0 - 1.0;
+    float radiusSq = dot(coord, coord);
+    if (radiusSq > 1.0) discard;
+    normal = vec3(coord.x, -coord.y, sqrt(1.0 - radiusSq));
+  }
+
+  // Impostors cast the eye ray through the billboard against the true sphere
+  if (particleMode == 3) {
+    vec3 ray = normalize(v);
+    float b = dot(ray, vSphereCentre);
+    float c = dot(vSphereCentre, vSphereCentre) - particleRadius * particleRadius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0) discard;
+
+    position = ray * (b - sqrt(discriminant));
+    normal = (position - vSphereCentre) / particleRadius;
+
+    // Write the depth of the sphere surface rather than the billboard
+#ifdef IMPOSTORS
+    vec4 clip = gl_ProjectionMatrix * vec4(position, 1.0);
+    float ndcDepth = clip.z / clip.w;
+    gl_FragDepth = (gl_DepthRange.diff * ndcDepth + gl_DepthRange.near + gl_DepthRange.far) * 0.5;
+#endif
+  }
+
   if(useLighting){
 
     int spotlightIndex = -1;
@@ -24,19 +68,19 @@ void main() {
     for (int lightIndex = 0; lightIndex < gl_MaxLights; lightIndex++) {
       vec3 color = vec3(0, 0, 0);
 
-      vec3 l = normalize(gl_LightSource[lightIndex].position.xyz - v);
-      vec3 e = normalize(-v);
-      vec3 r = normalize(reflect(-l, n));
+      vec3 l = normalize(gl_LightSource[lightIndex].position.xyz - position);
+      vec3 e = normalize(-position);
+      vec3 r = normalize(reflect(-l, normal));
 
-      float s_dot_n = max(dot(l, n), 0.0);
+      float s_dot_n = max(dot(l, normal), 0.0);
 
       // Ambient
       vec3 ambient = gl_LightSource[lightIndex].ambient.rgb *
-                     gl_FrontMaterial.ambient.rgb;
+                     ambientMaterial.rgb;
 
       // Diffuse
       vec3 diffuse = gl_LightSource[lightIndex].diffuse.rgb *
-                     gl_FrontMaterial.diffuse.rgb *
+                     diffuseMaterial.rgb *
                      s_dot_n;
 
       // Specular
@@ -44,7 +88,7 @@ void main() {
       if (s_dot_n > 0.0) {
         specular = gl_LightSource[lightIndex].specular.rgb *
                    gl_FrontMaterial.specular.rgb *
-                   pow(max(dot(r, normalize(-v)), 0.0), gl_FrontMaterial.shininess);
+                   pow(max(dot(r, e), 0.0), gl_FrontMaterial.shininess);
       }
 
       if (lightIndex == spotlightIndex) {
@@ -58,7 +102,7 @@ void main() {
       finalColor += vec4(color, 1);
     }
   } else{
-    finalColor = gl_FrontMaterial.ambient.rgba * gl_FrontMaterial.diffuse.rgba;
+    finalColor = ambientMaterial.rgba * diffuseMaterial.rgba;
   }
 
   if (useTexture) {
@@ -5,17 +5,75 @@ uniform sampler2D texture0;
 uniform bool useTexture;
 uniform bool useLighting;
 
+// Particle instancing, 0 for regular geometry, 1 for spheres, 2 for point sprites, 3 for impostors
+uniform int particleMode;
+uniform float particleRadius;
+uniform float pointScale;
+
+// Base radius, top radius and height to taper the shared unit cylinder into a branch, off when the height is 0
+uniform vec3 branchShape;
+
+// Per particle values when instancing
+attribute float instanceX;
+attribute float instanceY;
+attribute float instanceZ;
+attribute vec4 instanceColour;
+
 // Values to pass to the fragment shader
 varying vec2 vTextureCoord0;
 varying vec3 n;
 varying vec3 v;
+varying vec4 vInstanceColour;
+varying vec3 vSphereCentre;
 
 void main() {
 	vTextureCoord0 = gl_MultiTexCoord0.xy;
 
-  v = (gl_ModelViewMatrix * gl_Vertex).xyz;
-  n = normalize(gl_NormalMatrix * gl_Normal);
+  // Particles share a unit sphere, scaled to their radius
+  vec4 vertex = gl_Vertex;
+  if (particleMode > 0) {
+    vertex.xyz = vertex.xyz * particleRadius + vec3(instanceX, instanceY, instanceZ);
+    vInstanceColour = instanceColour;
+  }
+
+  // Side normals lean by the same angle generateCylinderGeometry gives them, the caps keep theirs
+  vec3 normal = gl_Normal;
+  if (branchShape.z > 0.0) {
+    vertex.xy *= branchShape.x + (branchShape.y - branchShape.x) * vertex.z;
+    vertex.z *= branchShape.z;
+
+    if (abs(gl_Normal.z) < 0.5) {
+      float theta = 1.5707963 * atan((branchShape.x - branchShape.y) / branchShape.z);
+      normal = vec3(gl_Normal.xy * cos(theta), sin(theta));
+    }
+  }
+
+  v = (gl_ModelViewMatrix * vertex).xyz;
+  n = normalize(gl_NormalMatrix * normal);
+
+  // Cover the projected diameter of the particle
+  if (particleMode == 2) {
+    gl_PointSize = pointScale * particleRadius / max(-v.z, 0.0001);
+  }
+
+  // Expand the quad corner in gl_Vertex into a billboard facing the eye, sized
+  // to cover the silhouette of the sphere under perspective
+  if (particleMode == 3) {
+    vec3 centre = (gl_ModelViewMatrix * vec4(instanceX, instanceY, instanceZ, 1.0)).xyz;
+    float dist = length(centre);
+    vec3 forward = centre / dist;
+    vec3 up = abs(forward.y) > 0.99 ? vec3(1.0, 0.0, 0.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(up, forward));
+    up = cross(forward, right);
+
+    float extent = particleRadius * dist / sqrt(max(dist * dist - particleRadius * particleRadius, 0.0001));
+    v = centre + (right * gl_Vertex.x + up * gl_Vertex.y) * extent;
+    vSphereCentre = centre;
+
+    gl_Position = gl_ProjectionMatrix * vec4(v, 1.0);
+    return;
+  }
 
-	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+	gl_Position = gl_ModelViewProjectionMatrix * vertex;
 }
 
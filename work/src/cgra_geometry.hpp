@@ -1,5 +1,8 @@
 #pragma once
 
+#include <map>
+#include <utility>
+
 #include "cgra_math.hpp"
 #include "opengl.hpp"
 #include "geometry.hpp"
@@ -449,4 +452,25 @@ namespace cgra {
 
 		return new Geometry(points, normals, uvs, triangles, true);
 	}
+
+	// Returns a sphere of radius 1 shared by every caller asking for the same detail,
+	// built on first use. Scale the modelview matrix to draw a sphere of any radius
+	inline Geometry* unitSphereGeometry(int slices = 10, int stacks = 10) {
+		static std::map<std::pair<int, int>, Geometry*> spheres;
+
+		Geometry *&sphere = spheres[std::make_pair(slices, stacks)];
+		if (sphere == nullptr) sphere = generateSphereGeometry(1.0f, slices, stacks);
+		return sphere;
+	}
+
+	// Returns a cylinder of radius and height 1 along z shared by every caller asking for
+	// the same detail, built on first use. The phong shader's branchShape uniform tapers it
+	// to a given base radius, top radius and height
+	inline Geometry* unitCylinderGeometry(int slices = 10, int stacks = 10) {
+		static std::map<std::pair<int, int>, Geometry*> cylinders;
+
+		Geometry *&cylinder = cylinders[std::make_pair(slices, stacks)];
+		if (cylinder == nullptr) cylinder = generateCylinderGeometry(1.0f, 1.0f, 1.0f, slices, stacks);
+		return cylinder;
+	}
 }
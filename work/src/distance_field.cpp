@@ -0,0 +1,169 @@
+//---------------------------------------------------------------------------
+// Signed Distance Field of a 3D Object
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "distance_field.hpp"
+#include "file_cache.hpp"
+#include "geometry.hpp"
+
+using namespace std;
+using namespace cgra;
+
+// Identifies the binary layout of cached distance field files
+static const uint32_t sdfFileMagic = 0x31464453; // "SDF1"
+
+void DistanceField::bake(Geometry *geometry, int resolution) {
+	uint64_t key = geometry->hash();
+	key = hashBytes(&resolution, sizeof(resolution), key);
+	string path = cacheFilePath(key, ".sdf");
+
+	// Skip the bake if this mesh has been converted before
+	if (load(path, key)) return;
+
+	m_resolution = resolution;
+
+	// Pad the grid by a cell so the field is valid just outside the mesh as well
+	vec3 minBounds = geometry->getMinBounds();
+	vec3 extent = geometry->getMaxBounds() - minBounds;
+	vec3 padding = extent / float(resolution - 2);
+	m_gridMin = minBounds - padding;
+	m_cellSize = (extent + padding * 2.0f) / float(resolution);
+
+	int stride = resolution + 1;
+	m_distances.assign(stride * stride * stride, 0.0f);
+
+	for (int k = 0; k < stride; k++) {
+		for (int j = 0; j < stride; j++) {
+			for (int i = 0; i < stride; i++) {
+				vec3 point = m_gridMin + vec3(i, j, k) * m_cellSize;
+				float dist = geometry->closestDistance(point);
+				m_distances[(k * stride + j) * stride + i] = geometry->pointInsideMesh(point) ? -dist : dist;
+			}
+		}
+	}
+
+	save(path, key);
+}
+
+bool DistanceField::empty() const {
+	return m_distances.empty();
+}
+
+// Attempt to read a previously baked field, checking it was baked from the same mesh
+bool DistanceField::load(string path, uint64_t key) {
+	ifstream file(path, ios::binary);
+	if (!file.is_open()) return false;
+
+	uint32_t magic = 0;
+	uint64_t fileKey = 0;
+	int resolution = 0;
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	file.read(reinterpret_cast<char*>(&fileKey), sizeof(fileKey));
+	file.read(reinterpret_cast<char*>(&resolution), sizeof(resolution));
+	if (!file || magic != sdfFileMagic || fileKey != key || resolution <= 0) return false;
+
+	int stride = resolution + 1;
+	vector<float> distances(stride * stride * stride);
+	file.read(reinterpret_cast<char*>(&m_gridMin), sizeof(m_gridMin));
+	file.read(reinterpret_cast<char*>(&m_cellSize), sizeof(m_cellSize));
+	file.read(reinterpret_cast<char*>(distances.data()), distances.size() * sizeof(float));
+	if (!file) return false;
+
+	m_resolution = resolution;
+	m_distances.swap(distances);
+	return true;
+}
+
+void DistanceField::save(string path, uint64_t key) {
+	ofstream file(path, ios::binary);
+	if (!file.is_open()) {
+		cerr << "Could not write distance field cache " << path << endl;
+		return;
+	}
+
+	file.write(reinterpret_cast<const char*>(&sdfFileMagic), sizeof(sdfFileMagic));
+	file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+	file.write(reinterpret_cast<const char*>(&m_resolution), sizeof(m_resolution));
+	file.write(reinterpret_cast<const char*>(&m_gridMin), sizeof(m_gridMin));
+	file.write(reinterpret_cast<const char*>(&m_cellSize), sizeof(m_cellSize));
+	file.write(reinterpret_cast<const char*>(m_distances.data()), m_distances.size() * sizeof(float));
+}
+
+float DistanceField::at(int i, int j, int k) const {
+	int stride = m_resolution + 1;
+	return m_distances[(k * stride + j) * stride + i];
+}
+
+// Find the cell containing the point and its fractional position within the cell
+// Points outside the grid are clamped to its boundary, returns false if that happened
+bool DistanceField::cellCoordinates(vec3 point, int &i, int &j, int &k, vec3 &f) const {
+	vec3 g = (point - m_gridMin) / m_cellSize;
+	vec3 clamped = clamp(g, 0.0f, m_resolution - 0.0001f);
+
+	i = int(clamped.x);
+	j = int(clamped.y);
+	k = int(clamped.z);
+	f = clamped - vec3(i, j, k);
+
+	return clamped == g;
+}
+
+float DistanceField::sample(vec3 point) const {
+	int i, j, k;
+	vec3 f;
+	bool inside = cellCoordinates(point, i, j, k, f);
+
+	// Trilinearly interpolate the distances at the cell corners
+	float c00 = at(i, j, k) + (at(i + 1, j, k) - at(i, j, k)) * f.x;
+	float c10 = at(i, j + 1, k) + (at(i + 1, j + 1, k) - at(i, j + 1, k)) * f.x;
+	float c01 = at(i, j, k + 1) + (at(i + 1, j, k + 1) - at(i, j, k + 1)) * f.x;
+	float c11 = at(i, j + 1, k + 1) + (at(i + 1, j + 1, k + 1) - at(i, j + 1, k + 1)) * f.x;
+	float c0 = c00 + (c10 - c00) * f.y;
+	float c1 = c01 + (c11 - c01) * f.y;
+	float dist = c0 + (c1 - c0) * f.z;
+
+	// Outside the grid, add on the distance to the grid boundary
+	if (!inside) {
+		vec3 boundaryPoint = m_gridMin + (vec3(i, j, k) + f) * m_cellSize;
+		dist += length(point - boundaryPoint);
+	}
+
+	return dist;
+}
+
+vec3 DistanceField::gradient(vec3 point) const {
+	int i, j, k;
+	vec3 f;
+	bool inside = cellCoordinates(point, i, j, k, f);
+
+	// Outside the grid the closest surface is back towards the grid
+	if (!inside) {
+		vec3 boundaryPoint = m_gridMin + (vec3(i, j, k) + f) * m_cellSize;
+		return point - boundaryPoint;
+	}
+
+	// Analytic derivative of the trilinear interpolation
+	float c000 = at(i, j, k), c100 = at(i + 1, j, k);
+	float c010 = at(i, j + 1, k), c110 = at(i + 1, j + 1, k);
+	float c001 = at(i, j, k + 1), c101 = at(i + 1, j, k + 1);
+	float c011 = at(i, j + 1, k + 1), c111 = at(i + 1, j + 1, k + 1);
+
+	float dx = (1 - f.y) * (1 - f.z) * (c100 - c000) + f.y * (1 - f.z) * (c110 - c010)
+		+ (1 - f.y) * f.z * (c101 - c001) + f.y * f.z * (c111 - c011);
+	float dy = (1 - f.x) * (1 - f.z) * (c010 - c000) + f.x * (1 - f.z) * (c110 - c100)
+		+ (1 - f.x) * f.z * (c011 - c001) + f.x * f.z * (c111 - c101);
+	float dz = (1 - f.x) * (1 - f.y) * (c001 - c000) + f.x * (1 - f.y) * (c101 - c100)
+		+ (1 - f.x) * f.y * (c011 - c010) + f.x * f.y * (c111 - c110);
+
+	return vec3(dx, dy, dz) / m_cellSize;
+}
@@ -0,0 +1,40 @@
+//---------------------------------------------------------------------------
+// Signed Distance Field of a 3D Object
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "geometry.hpp"
+
+class DistanceField {
+
+	public:
+		// Bake the field from the geometry, loading it from the disk cache if it was baked before
+		void bake(Geometry*, int resolution = 32);
+		bool empty() const;
+
+		// Signed distance to the mesh surface, negative inside the mesh
+		float sample(cgra::vec3) const;
+
+		// Gradient of the distance, which points away from the closest surface. Not normalised
+		// and zero where the field is flat
+		cgra::vec3 gradient(cgra::vec3) const;
+
+	private:
+		int m_resolution = 0;
+		cgra::vec3 m_gridMin = cgra::vec3(0.0f, 0.0f, 0.0f);
+		cgra::vec3 m_cellSize = cgra::vec3(0.0f, 0.0f, 0.0f);
+		std::vector<float> m_distances; // (resolution + 1)^3 samples at the cell corners
+
+		bool load(std::string, uint64_t);
+		void save(std::string, uint64_t);
+		bool cellCoordinates(cgra::vec3, int&, int&, int&, cgra::vec3&) const;
+		float at(int, int, int) const;
+};
@@ -0,0 +1,60 @@
+//---------------------------------------------------------------------------
+// On Disk Cache Helpers
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Directory that cached build results are written to, relative to the project directory
+const std::string cacheDirectory = "./work/res/cache/";
+
+// 64 bit FNV-1a hash, pass the previous result back in to hash several blocks of data
+inline uint64_t hashBytes(const void *data, std::size_t size, uint64_t hash = 14695981039346656037ull) {
+	const unsigned char *bytes = static_cast<const unsigned char*>(data);
+	for (std::size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Gets the size and last modification time of a file, returns false if it does not exist
+inline bool fileStamp(const std::string &path, uint64_t &size, int64_t &modified) {
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0) return false;
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) return false;
+#endif
+
+	size = info.st_size;
+	modified = info.st_mtime;
+	return true;
+}
+
+// Returns the path of the cache file for the given key, creating the cache directory if needed
+inline std::string cacheFilePath(uint64_t key, const std::string &extension) {
+#ifdef _WIN32
+	_mkdir(cacheDirectory.c_str());
+#else
+	mkdir(cacheDirectory.c_str(), 0755);
+#endif
+
+	std::ostringstream path;
+	path << cacheDirectory << std::hex << std::setw(16) << std::setfill('0') << key << extension;
+	return path.str();
+}
@@ -0,0 +1,90 @@
+//---------------------------------------------------------------------------
+// View Frustum Culling
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <cmath>
+
+#include "cgra_math.hpp"
+#include "frustum.hpp"
+#include "opengl.hpp"
+
+using namespace std;
+using namespace cgra;
+
+// Clip space is the cube -w <= x, y, z <= w, its faces as planes in homogeneous coordinates
+static const vec4 clipPlanes[6] = {
+	vec4(1.0f, 0.0f, 0.0f, 1.0f), vec4(-1.0f, 0.0f, 0.0f, 1.0f),
+	vec4(0.0f, 1.0f, 0.0f, 1.0f), vec4(0.0f, -1.0f, 0.0f, 1.0f),
+	vec4(0.0f, 0.0f, 1.0f, 1.0f), vec4(0.0f, 0.0f, -1.0f, 1.0f)
+};
+
+Frustum::Frustum(const mat4 &projection, const mat4 &modelview) {
+	// A plane p takes points v into clip space as p . (M v), the same as (p M) . v
+	mat4 clip = projection * modelview;
+	for (int i = 0; i < 6; i++) {
+		planes[i] = clipPlanes[i] * clip;
+	}
+	normalizePlanes();
+}
+
+Frustum Frustum::fromCurrentMatrices() {
+	mat4 projection, modelview;
+	glGetFloatv(GL_PROJECTION_MATRIX, projection.dataPointer());
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview.dataPointer());
+	return Frustum(projection, modelview);
+}
+
+Frustum Frustum::transformed(const mat4 &transform) const {
+	Frustum frustum;
+	for (int i = 0; i < 6; i++) {
+		frustum.planes[i] = planes[i] * transform;
+	}
+
+	// Scaling transforms leave the normals no longer unit length
+	frustum.normalizePlanes();
+	return frustum;
+}
+
+void Frustum::normalizePlanes() {
+	for (vec4 &plane : planes) {
+		float length = sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		if (length > 0.0f) plane /= length;
+	}
+}
+
+// Each plane is tested against the box corner furthest along its normal, and the
+// corner furthest against it, to tell if the box is partly or wholly inside
+frustumTest Frustum::testBox(vec3 minBounds, vec3 maxBounds) const {
+	frustumTest result = frustumTest::inside;
+
+	for (const vec4 &plane : planes) {
+		vec3 furthest = vec3(
+			plane.x >= 0.0f ? maxBounds.x : minBounds.x,
+			plane.y >= 0.0f ? maxBounds.y : minBounds.y,
+			plane.z >= 0.0f ? maxBounds.z : minBounds.z);
+		if (plane.x * furthest.x + plane.y * furthest.y + plane.z * furthest.z + plane.w < 0.0f) return frustumTest::outside;
+
+		vec3 nearest = vec3(
+			plane.x >= 0.0f ? minBounds.x : maxBounds.x,
+			plane.y >= 0.0f ? minBounds.y : maxBounds.y,
+			plane.z >= 0.0f ? minBounds.z : maxBounds.z);
+		if (plane.x * nearest.x + plane.y * nearest.y + plane.z * nearest.z + plane.w < 0.0f) result = frustumTest::intersecting;
+	}
+
+	return result;
+}
+
+bool Frustum::intersectsBox(vec3 minBounds, vec3 maxBounds) const {
+	return testBox(minBounds, maxBounds) != frustumTest::outside;
+}
+
+// Conservative, a sphere just beyond a corner of the frustum can be in front of every
+// plane on its own and still count as visible
+bool Frustum::intersectsSphere(vec3 centre, float radius) const {
+	for (const vec4 &plane : planes) {
+		if (plane.x * centre.x + plane.y * centre.y + plane.z * centre.z + plane.w < -radius) return false;
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+//---------------------------------------------------------------------------
+// View Frustum Culling
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include "cgra_math.hpp"
+
+enum class frustumTest {
+	outside,
+	intersecting,
+	inside
+};
+
+// The six planes bounding what the camera can see, each facing inwards. Planes are
+// found in the space the modelview matrix transforms from, so bounds can be tested
+// in the same space they are drawn in without transforming them
+class Frustum {
+
+	public:
+		Frustum(const cgra::mat4 &projection, const cgra::mat4 &modelview);
+
+		// The frustum of the current projection and modelview matrices
+		static Frustum fromCurrentMatrices();
+
+		// The same frustum in the space reached by multiplying the modelview matrix with
+		// the given transform, so children can be tested without reading back the matrix
+		Frustum transformed(const cgra::mat4&) const;
+
+		frustumTest testBox(cgra::vec3, cgra::vec3) const;
+		bool intersectsBox(cgra::vec3, cgra::vec3) const;
+		bool intersectsSphere(cgra::vec3, float) const;
+
+	private:
+		Frustum() = default;
+
+		// Left, right, bottom, top, near and far, as (normal, distance) with unit normals
+		cgra::vec4 planes[6];
+
+		void normalizePlanes();
+};
@@ -9,12 +9,19 @@
 //---------------------------------------------------------------------------
 
 #include <cmath>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "cgra_math.hpp"
 #include "cgra_geometry.hpp"
+#include "file_cache.hpp"
 #include "fuzzy_object.hpp"
 #include "geometry.hpp"
 #include "opengl.hpp"
@@ -22,10 +29,17 @@
 using namespace std;
 using namespace cgra;
 
-FuzzyObject::FuzzyObject(Geometry *geometry) {
+// Identifies the binary layout of cached particle system files
+static const uint32_t fuzzyFileMagic = 0x315A5A46; // "FZZ1"
+
+FuzzyObject::FuzzyObject(Geometry *geometry, bool useDistanceField) {
 	g_geometry = geometry;
 
-	setupDisplayList();
+	// Boundary collisions become field lookups instead of ray casts
+	if (useDistanceField) distanceField.bake(geometry, distanceFieldResolution);
+
+	renderer.setRadius(p_radius);
+	updatePotentialConstants();
 
 	spawnPoint = geometry->getOrigin();
 
@@ -35,22 +49,6 @@ FuzzyObject::FuzzyObject(Geometry *geometry) {
 
 FuzzyObject::~FuzzyObject() {}
 
-// Setup the particle instance geometry
-void FuzzyObject::setupDisplayList() {
-
-	// Delete the old list if there is one
-	if (p_displayList) glDeleteLists(p_displayList, 1);
-
-	// Setup the new display list
-	p_displayList = glGenLists(1);
-	glNewList(p_displayList, GL_COMPILE);
-
-	// Draw the geometry
-	cgraSphere(p_radius, 6, 6);
-
-	glEndList();
-}
-
 // Iterate one step through the system building algorithm
 void FuzzyObject::buildSystemIncrement() {
 	buildSystem(true);
@@ -58,6 +56,16 @@ void FuzzyObject::buildSystemIncrement() {
 
 // Build the particle system
 void FuzzyObject::buildSystem(bool incremental) {
+	if (buildFinished) return;
+
+	// Bulk seeding fills the mesh up front, leaving only the final pass to relax it
+	if (seeding == seedingMode::bulk && !firstPassFinished) {
+		seedParticles();
+		firstPassFinished = true;
+
+		if (incremental) return;
+	}
+
 	// First pass
 	while (!firstPassFinished && !stoppingCriteria()) {
 		addParticle();
@@ -70,31 +78,120 @@ void FuzzyObject::buildSystem(bool incremental) {
 	// Final pass
 	while (!systemAtRest()) {
 		updateBuildingSystem();
+		settleSteps++;
 
 		// Return now if we only wanted to build one step
 		if (incremental) return;
 	}
 
+	finishBuilding();
+}
+
+// Mark the system as built and store it so later runs can skip building it
+void FuzzyObject::finishBuilding() {
 	buildFinished = true;
+
+	// Only systems that were looked up in the cache are worth storing
+	if (!cached) return;
+
+	uint64_t key = cacheKey();
+	string path = cacheFilePath(key, ".fuzzy");
+	ofstream file(path, ios::binary);
+	if (!file.is_open()) {
+		cerr << "Could not write particle system cache " << path << endl;
+		return;
+	}
+
+	// Only the settled positions are kept, everything else is reset when loaded
+	int count = getParticleCount();
+	file.write(reinterpret_cast<const char*>(&fuzzyFileMagic), sizeof(fuzzyFileMagic));
+	file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+	file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	file.write(reinterpret_cast<const char*>(&buildSteps), sizeof(buildSteps));
+	file.write(reinterpret_cast<const char*>(particlePos.x.data()), count * sizeof(float));
+	file.write(reinterpret_cast<const char*>(particlePos.y.data()), count * sizeof(float));
+	file.write(reinterpret_cast<const char*>(particlePos.z.data()), count * sizeof(float));
 }
 
-// Determines when the particle system has been fully generated
-bool FuzzyObject::stoppingCriteria() {
-	if (particles.size() >= particleLimit) return true;
+bool FuzzyObject::loadCachedSystem() {
+	if (buildFinished) return true;
+	if (getParticleCount() > 0) return false;
+	cached = true;
+
+	uint64_t key = cacheKey();
+	ifstream file(cacheFilePath(key, ".fuzzy"), ios::binary);
+	if (!file.is_open()) return false;
+
+	uint32_t magic = 0;
+	uint64_t fileKey = 0;
+	int count = 0;
+	int steps = 0;
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	file.read(reinterpret_cast<char*>(&fileKey), sizeof(fileKey));
+	file.read(reinterpret_cast<char*>(&count), sizeof(count));
+	file.read(reinterpret_cast<char*>(&steps), sizeof(steps));
+	if (!file || magic != fuzzyFileMagic || fileKey != key || count < 0 || count > particleLimit) return false;
+
+	vec3Array positions;
+	positions.resize(count);
+	file.read(reinterpret_cast<char*>(positions.x.data()), count * sizeof(float));
+	file.read(reinterpret_cast<char*>(positions.y.data()), count * sizeof(float));
+	file.read(reinterpret_cast<char*>(positions.z.data()), count * sizeof(float));
+	if (!file) return false;
+
+	// The system is already at rest, so particles start still and are never simulated again
+	particlePos = positions;
+	particleVel.resize(count);
+	particleAcc.resize(count);
+	particleInfo.resize(count);
+	for (fuzzyParticleInfo &info : particleInfo) {
+		info.col = vec3(1.0f, 1.0f, 1.0f);
+		info.triangleIndex = 0;
+		info.inCollision = false;
+		info.id = nextUniqueId++;
+	}
 
-	// If all the particles are in collision
-	if (collisionCount == particles.size() && particles.size() > minParticleCount) {
+	buildSteps = steps;
+	firstPassFinished = true;
+	buildFinished = true;
+	return true;
+}
 
-		// Perform a number of stability updates
-		for (int i = 0; i < stabilityUpdates; i++) {
-			updateBuildingSystem();
-		}
+// Hash of the mesh and of every parameter that changes the built system
+uint64_t FuzzyObject::cacheKey() {
+	float parameters[] = {
+		spawnPoint.x, spawnPoint.y, spawnPoint.z,
+		p_velRange, p_radius, p_boundaryRadius, p_mass, p_spawnOffset, p_latticeSpacing,
+		e_strength, e_lengthScale, e_effectRange,
+		meshCollisionFriction, particleCollisionFriction,
+		fillRatioThreshold, restDisplacementScale, restSpeedScale
+	};
+	int settings[] = {
+		particleLimit, minParticleCount, stabilityUpdates, maxSettleSteps,
+		int(seeding), distanceField.empty() ? 0 : distanceFieldResolution
+	};
+
+	uint64_t key = g_geometry->hash();
+	key = hashBytes(parameters, sizeof(parameters), key);
+	return hashBytes(settings, sizeof(settings), key);
+}
 
-		// If the system is still unstable then the build process is complete
-		if (collisionCount == particles.size() && particles.size() > minParticleCount) {
-			firstPassFinished = true;
-			return true;
-		}
+// Ignored once the system has started building, switching part way through would seed
+// a second set of particles on top of the first
+void FuzzyObject::setSeedingMode(seedingMode mode) {
+	if (getParticleCount() > 0 || buildSteps > 0) return;
+	seeding = mode;
+}
+
+// Determines when the particle system has been fully generated
+bool FuzzyObject::stoppingCriteria() {
+	if (getParticleCount() >= particleLimit) return true;
+
+	// If enough of the particles have been in collision for a number of stability updates
+	// then the mesh is packed and the build process is complete
+	if (packedSteps >= stabilityUpdates) {
+		firstPassFinished = true;
+		return true;
 	}
 
 	return false;
@@ -102,36 +199,121 @@ bool FuzzyObject::stoppingCriteria() {
 
 // Determines when the system has gained stability after all the particles have been added
 bool FuzzyObject::systemAtRest() {
+	if (settleSteps >= maxSettleSteps) return true;
 
-	// Not currently checking this yet
-	return true;
+	return restingSteps >= stabilityUpdates;
 }
 
 // Add a new particle to the system
 void FuzzyObject::addParticle() {
 
 	// Do not add another particle if we reached the limit
-	if (particles.size() >= particleLimit) return;
+	if (getParticleCount() >= particleLimit) return;
 
-	fuzzyParticle p;
-	p.pos = vec3(spawnPoint.x + math::random(-p_spawnOffset, p_spawnOffset),
-							 spawnPoint.y + math::random(-p_spawnOffset, p_spawnOffset),
-							 spawnPoint.z + math::random(-p_spawnOffset, p_spawnOffset));
+	insertParticle(vec3(spawnPoint.x + math::random(-p_spawnOffset, p_spawnOffset),
+											spawnPoint.y + math::random(-p_spawnOffset, p_spawnOffset),
+											spawnPoint.z + math::random(-p_spawnOffset, p_spawnOffset)));
+}
 
-	p.acc = vec3(0.0f, 0.0f, 0.0f);
+// Add a new particle at the given position with a random velocity
+void FuzzyObject::insertParticle(vec3 pos) {
+	particlePos.push_back(pos);
 
 	// Random velocity generation
-	p.vel = vec3(math::random(-1.0f, 1.0f) * p_velRange,
-							 math::random(-1.0f, 1.0f) * p_velRange,
-							 math::random(-1.0f, 1.0f) * p_velRange);
+	particleVel.push_back(vec3(math::random(-1.0f, 1.0f) * p_velRange,
+														 math::random(-1.0f, 1.0f) * p_velRange,
+														 math::random(-1.0f, 1.0f) * p_velRange));
 
-	p.col = vec3(1.0f, 1.0f, 1.0f);
+	particleAcc.push_back(vec3(0.0f, 0.0f, 0.0f));
 
-	p.id = nextUniqueId++;
+	fuzzyParticleInfo info;
+	info.col = vec3(1.0f, 1.0f, 1.0f);
+	info.id = nextUniqueId++;
+	particleInfo.push_back(info);
+
+	if (distanceField.empty()) updateFacingTriangle(getParticleCount() - 1);
+}
+
+// Fill the interior of the mesh with a jittered lattice of particles in one go
+// The lattice is slightly tighter than the LJ equilibrium distance so the final
+// pass only needs to relax the particles apart
+void FuzzyObject::seedParticles() {
+	vec3 minBounds = g_geometry->getMinBounds();
+	vec3 maxBounds = g_geometry->getMaxBounds();
+	vec3 extent = maxBounds - minBounds;
+	float spacing = e_effectRange * p_latticeSpacing;
+
+	vector<vec3> candidates;
+
+	// Widen the lattice until the particles fit within the limit
+	for (int attempt = 0; attempt < 8; attempt++) {
+		candidates.clear();
+
+		int nx = max(1, int(extent.x / spacing));
+		int ny = max(1, int(extent.y / spacing));
+		int nz = max(1, int(extent.z / spacing));
+
+		// Center the lattice within the bounds
+		vec3 start = minBounds + (extent - vec3(nx - 1, ny - 1, nz - 1) * spacing) * 0.5f;
+
+		for (int x = 0; x < nx; x++) {
+			for (int y = 0; y < ny; y++) {
+				for (int z = 0; z < nz; z++) {
+					vec3 pos = start + vec3(x, y, z) * spacing;
+					pos += vec3(math::random(-p_spawnOffset, p_spawnOffset),
+											math::random(-p_spawnOffset, p_spawnOffset),
+											math::random(-p_spawnOffset, p_spawnOffset));
+
+					if (g_geometry->pointInsideMeshFast(pos)) candidates.push_back(pos);
+				}
+			}
+		}
+
+		if (candidates.size() <= size_t(particleLimit)) break;
+
+		spacing *= cbrt(candidates.size() / float(particleLimit)) * 1.01f;
+	}
+
+	int count = min(int(candidates.size()), particleLimit);
+	particlePos.reserve(count);
+	particleVel.reserve(count);
+	particleAcc.reserve(count);
+	particleInfo.reserve(count);
+
+	// If there are still too many, take them evenly from across the lattice rather than
+	// the first ones generated, which would only fill the low x end of the mesh
+	for (int i = 0; i < count; i++) {
+		insertParticle(candidates[size_t(i) * candidates.size() / count]);
+	}
+}
+
+// Remove the particles marked for deletion, compacting the remaining ones in place
+void FuzzyObject::removeParticles() {
+	int count = getParticleCount();
+	int next = 0; // Index into the sorted deletion list
+	int kept = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (next < int(particlesForDeletion.size()) && particlesForDeletion[next] == i) {
+			next++;
+			continue;
+		}
+
+		if (kept != i) {
+			particlePos.move(i, kept);
+			particleVel.move(i, kept);
+			particleAcc.move(i, kept);
+			particleInfo[kept] = std::move(particleInfo[i]);
+		}
+		kept++;
+	}
 
-	particles.push_back(p);
+	particlePos.resize(kept);
+	particleVel.resize(kept);
+	particleAcc.resize(kept);
+	particleInfo.resize(kept);
 
-	updateFacingTriangle(particles.size() - 1);
+	particlesForDeletion.clear();
 }
 
 // Perform one update step in the system building process
@@ -139,14 +321,25 @@ void FuzzyObject::updateBuildingSystem() {
 	collisionCount = 0;
 
 	// Reset required fields on each particle for the next update
-	for (int i = 0; i < particles.size(); i++) {
-		particles[i].acc = vec3(0.0f, 0.0f, 0.0f);
-		particles[i].inCollision = false;
+	particleAcc.fill(vec3(0.0f, 0.0f, 0.0f));
+
+	for (int i = 0; i < getParticleCount(); i++) {
+		fuzzyParticleInfo &info = particleInfo[i];
+		info.inCollision = false;
+
+		// Check if the particle left the mesh, using the distance field or cached occupancy grid
+		// if available, otherwise check which side of its facing triangle the particle is on
+		bool escaped;
+		if (!distanceField.empty()) {
+			escaped = distanceField.sample(particlePos.get(i)) > 0.0f;
+		} else if (g_geometry->hasOccupancyGrid()) {
+			escaped = !g_geometry->pointInsideMeshFast(particlePos.get(i));
+		} else {
+			float d = dot(particlePos.get(i) - info.triangleIntersectionPos, -g_geometry->getSurfaceNormal(info.triangleIndex));
+			escaped = d < 0.0f || d >= maxFloatVector.x;
+		}
 
-		// Check if the particle left the mesh
-		//if (!g_geometry->pointInsideMesh(particles[i].pos)) {
-		float d = dot(particles[i].pos - particles[i].triangleIntersectionPos, -g_geometry->getSurfaceNormal(particles[i].triangleIndex));
-		if (d < 0.0f || d >= maxFloatVector.x) {
+		if (escaped) {
 
 			// Mark it for deletion
 			particlesForDeletion.push_back(i);
@@ -154,18 +347,7 @@ void FuzzyObject::updateBuildingSystem() {
 	}
 
 	// Delete any particles marked for deletion
-	if (particlesForDeletion.size() > 0) {
-		vector<fuzzyParticle> newParticles;
-
-		for (int i = 0; i < particles.size(); i++) {
-			if (find(particlesForDeletion.begin(), particlesForDeletion.end(), i) == particlesForDeletion.end()) {
-				newParticles.push_back(particles[i]);
-			}
-		}
-
-		particlesForDeletion.clear();
-		particles = newParticles;
-	}
+	if (particlesForDeletion.size() > 0) removeParticles();
 
 	// Apply LJ physics based forces to the particle system
 	applyParticleForces();
@@ -173,65 +355,239 @@ void FuzzyObject::updateBuildingSystem() {
 	// Apply forces to particles that collide with the mesh geometry
 	applyBoundaryForces();
 
-	// Update the particle positions and velocities
-	for (int i = 0; i < particles.size(); i++) {
-		particles[i].acc /= p_mass;
-		particles[i].vel = clamp(particles[i].vel + particles[i].acc, -p_velRange, p_velRange);
-		particles[i].pos += particles[i].vel;
+	// Update the particle positions and velocities, one component array at a time
+	int count = getParticleCount();
+	float invMass = 1.0f / p_mass;
+	float *posComponents[3] = { particlePos.x.data(), particlePos.y.data(), particlePos.z.data() };
+	float *velComponents[3] = { particleVel.x.data(), particleVel.y.data(), particleVel.z.data() };
+	float *accComponents[3] = { particleAcc.x.data(), particleAcc.y.data(), particleAcc.z.data() };
+
+	for (int c = 0; c < 3; c++) {
+		float *pos = posComponents[c];
+		float *vel = velComponents[c];
+		float *acc = accComponents[c];
+
+		for (int i = 0; i < count; i++) {
+			acc[i] *= invMass;
+			vel[i] = min(max(vel[i] + acc[i], -p_velRange), p_velRange);
+			pos[i] += vel[i];
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
 
 		// If the particle accelerated it has potentially changed direction
-		if (particles[i].acc.x != 0.0f && particles[i].acc.y != 0.0f && particles[i].acc.z != 0.0f) {
+		if (distanceField.empty() && particleAcc.x[i] != 0.0f && particleAcc.y[i] != 0.0f && particleAcc.z[i] != 0.0f) {
 
 			// Recompute the particle facing triangle
 			updateFacingTriangle(i);
 		}
 
-		if (particles[i].inCollision) collisionCount++;
+		if (particleInfo[i].inCollision) collisionCount++;
 	}
+
+	buildSteps++;
+	updateConvergenceStats();
 }
 
-// Apply forces between particles
-void FuzzyObject::applyParticleForces() {
+// Measure how settled the system is after an update step
+void FuzzyObject::updateConvergenceStats() {
+	int count = getParticleCount();
+	const float *velX = particleVel.x.data();
+	const float *velY = particleVel.y.data();
+	const float *velZ = particleVel.z.data();
+
+	// Each particle moved by its velocity this step
+	float sumSpeedSq = 0.0f;
+	float maxSpeedSq = 0.0f;
+	for (int i = 0; i < count; i++) {
+		float speedSq = velX[i] * velX[i] + velY[i] * velY[i] + velZ[i] * velZ[i];
+		sumSpeedSq += speedSq;
+		maxSpeedSq = max(maxSpeedSq, speedSq);
+	}
 
-	// For each pair of particles
-	for (int i = 0; i < particles.size(); i++) {
-		for (int j = i + 1; j < particles.size(); j++) {
+	stats.kineticEnergy = count > 0 ? 0.5f * p_mass * sumSpeedSq / count : 0.0f;
+	stats.maxDisplacement = sqrt(maxSpeedSq);
+	stats.fillRatio = count > 0 ? collisionCount / float(count) : 0.0f;
 
-			// If the particles are within the effect range of eachother we count this as a collision
-			if (withinRange(particles[i].pos, particles[j].pos, e_effectRange)) {
+	bool packed = stats.fillRatio >= fillRatioThreshold && count > minParticleCount;
+	packedSteps = packed ? packedSteps + 1 : 0;
 
-				// Compute the distance between particles
-				vec3 distVector = particles[i].pos - particles[j].pos;
-				float dist = length(distVector);
+	// Velocities are clamped to p_velRange, so the rest thresholds follow it
+	float restSpeed = restSpeedScale * p_velRange;
+	float restKineticEnergy = 0.5f * p_mass * restSpeed * restSpeed;
+	float restDisplacement = restDisplacementScale * p_velRange;
+	bool resting = stats.kineticEnergy <= restKineticEnergy && stats.maxDisplacement <= restDisplacement;
+	restingSteps = resting ? restingSteps + 1 : 0;
+}
 
-				if (dist < 0.001f) continue; // Prevent dividing by 0 effects
+// Precompute the constants used by the LJ force kernel
+// The force between two particles at distance r apart along distVector is
+//   48 * strength / lengthScale^2 * ((lengthScale / r)^14 - 0.5 * (lengthScale / r)^8) * distVector
+// which only depends on q = lengthScale^2 / r^2, so no square roots or pow calls are needed per pair
+void FuzzyObject::updatePotentialConstants() {
+	e_forceScale = 48.0f * e_strength / (e_lengthScale * e_lengthScale);
+	e_lengthScaleSq = e_lengthScale * e_lengthScale;
+	e_effectRangeSq = e_effectRange * e_effectRange;
+}
 
-				// Compute and apply the force both particles exert on eachother
-				vec3 force = forceAtDistance(dist, distVector);
-				particles[i].acc += force;
-				particles[j].acc -= force;
+// Particles closer than this squared distance are ignored to prevent dividing by 0 effects
+static const float minForceDistSq = 0.001f * 0.001f;
+
+// Accumulate the LJ forces between particle i and particles [begin, end) one pair at a time
+// Returns the number of particles found within the effect range
+static float accumulatePairForcesScalar(int i, int begin, int end, const float *posX, const float *posY, const float *posZ,
+	float *accX, float *accY, float *accZ, float *contacts, float forceScale, float lengthScaleSq, float effectRangeSq) {
+	float xi = posX[i], yi = posY[i], zi = posZ[i];
+	float ax = 0.0f, ay = 0.0f, az = 0.0f;
+	float count = 0.0f;
+
+	for (int j = begin; j < end; j++) {
+		float dx = xi - posX[j];
+		float dy = yi - posY[j];
+		float dz = zi - posZ[j];
+		float distSq = dx * dx + dy * dy + dz * dz;
+
+		if (distSq >= effectRangeSq || distSq < minForceDistSq) continue;
+
+		// (lengthScale / r)^14 and (lengthScale / r)^8 as integer powers of q
+		float q = lengthScaleSq / distSq;
+		float q2 = q * q;
+		float q4 = q2 * q2;
+		float q7 = q4 * q2 * q;
+		float s = forceScale * (q7 - 0.5f * q4);
+
+		ax += s * dx;
+		ay += s * dy;
+		az += s * dz;
+		accX[j] -= s * dx;
+		accY[j] -= s * dy;
+		accZ[j] -= s * dz;
+
+		contacts[j] += 1.0f;
+		count += 1.0f;
+	}
 
-				// Apply friction to the particle
-				particles[i].vel *= particleCollisionFriction;
-				particles[j].vel *= particleCollisionFriction;
+	accX[i] += ax;
+	accY[i] += ay;
+	accZ[i] += az;
 
-				particles[i].inCollision = true;
-				particles[j].inCollision = true;
-			}
-		}
+	return count;
+}
+
+#ifdef __AVX2__
+static inline float horizontalSum(__m256 v) {
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+// Accumulate the LJ forces between particle i and particles [begin, end), eight neighbours at a time
+// The remainder that does not fill a full vector is handled by the scalar kernel
+static float accumulatePairForces(int i, int begin, int end, const float *posX, const float *posY, const float *posZ,
+	float *accX, float *accY, float *accZ, float *contacts, float forceScale, float lengthScaleSq, float effectRangeSq) {
+	const __m256 xi = _mm256_set1_ps(posX[i]);
+	const __m256 yi = _mm256_set1_ps(posY[i]);
+	const __m256 zi = _mm256_set1_ps(posZ[i]);
+	const __m256 scale = _mm256_set1_ps(forceScale);
+	const __m256 sigmaSq = _mm256_set1_ps(lengthScaleSq);
+	const __m256 rangeSq = _mm256_set1_ps(effectRangeSq);
+	const __m256 minDistSq = _mm256_set1_ps(minForceDistSq);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	__m256 ax = _mm256_setzero_ps();
+	__m256 ay = _mm256_setzero_ps();
+	__m256 az = _mm256_setzero_ps();
+	__m256 count = _mm256_setzero_ps();
+
+	int j = begin;
+	for (; j + 8 <= end; j += 8) {
+		__m256 dx = _mm256_sub_ps(xi, _mm256_loadu_ps(posX + j));
+		__m256 dy = _mm256_sub_ps(yi, _mm256_loadu_ps(posY + j));
+		__m256 dz = _mm256_sub_ps(zi, _mm256_loadu_ps(posZ + j));
+		__m256 distSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(dz, dz)));
+
+		__m256 inRange = _mm256_and_ps(_mm256_cmp_ps(distSq, rangeSq, _CMP_LT_OQ), _mm256_cmp_ps(distSq, minDistSq, _CMP_GE_OQ));
+		if (_mm256_movemask_ps(inRange) == 0) continue;
+
+		// Out of range lanes may divide by 0 here, they are masked out below
+		__m256 q = _mm256_div_ps(sigmaSq, distSq);
+		__m256 q2 = _mm256_mul_ps(q, q);
+		__m256 q4 = _mm256_mul_ps(q2, q2);
+		__m256 q7 = _mm256_mul_ps(_mm256_mul_ps(q4, q2), q);
+		__m256 s = _mm256_and_ps(inRange, _mm256_mul_ps(scale, _mm256_sub_ps(q7, _mm256_mul_ps(half, q4))));
+
+		__m256 fx = _mm256_mul_ps(s, dx);
+		__m256 fy = _mm256_mul_ps(s, dy);
+		__m256 fz = _mm256_mul_ps(s, dz);
+
+		ax = _mm256_add_ps(ax, fx);
+		ay = _mm256_add_ps(ay, fy);
+		az = _mm256_add_ps(az, fz);
+		_mm256_storeu_ps(accX + j, _mm256_sub_ps(_mm256_loadu_ps(accX + j), fx));
+		_mm256_storeu_ps(accY + j, _mm256_sub_ps(_mm256_loadu_ps(accY + j), fy));
+		_mm256_storeu_ps(accZ + j, _mm256_sub_ps(_mm256_loadu_ps(accZ + j), fz));
+
+		__m256 hits = _mm256_and_ps(inRange, one);
+		_mm256_storeu_ps(contacts + j, _mm256_add_ps(_mm256_loadu_ps(contacts + j), hits));
+		count = _mm256_add_ps(count, hits);
+	}
+
+	accX[i] += horizontalSum(ax);
+	accY[i] += horizontalSum(ay);
+	accZ[i] += horizontalSum(az);
+
+	return horizontalSum(count) + accumulatePairForcesScalar(i, j, end, posX, posY, posZ, accX, accY, accZ, contacts, forceScale, lengthScaleSq, effectRangeSq);
+}
+#else
+static float accumulatePairForces(int i, int begin, int end, const float *posX, const float *posY, const float *posZ,
+	float *accX, float *accY, float *accZ, float *contacts, float forceScale, float lengthScaleSq, float effectRangeSq) {
+	return accumulatePairForcesScalar(i, begin, end, posX, posY, posZ, accX, accY, accZ, contacts, forceScale, lengthScaleSq, effectRangeSq);
+}
+#endif
+
+// Apply forces between particles, based on the Lennard Jones potentials model
+void FuzzyObject::applyParticleForces() {
+	int count = getParticleCount();
+
+	particleContacts.assign(count, 0.0f);
+
+	// For each pair of particles
+	// If the particles are within the effect range of eachother we count this as a collision
+	for (int i = 0; i < count; i++) {
+		particleContacts[i] += accumulatePairForces(i, i + 1, count,
+			particlePos.x.data(), particlePos.y.data(), particlePos.z.data(),
+			particleAcc.x.data(), particleAcc.y.data(), particleAcc.z.data(),
+			particleContacts.data(), e_forceScale, e_lengthScaleSq, e_effectRangeSq);
+	}
+
+	// Apply friction once per collision the particle was involved in
+	for (int i = 0; i < count; i++) {
+		if (particleContacts[i] == 0.0f) continue;
+
+		particleVel.set(i, particleVel.get(i) * pow(particleCollisionFriction, particleContacts[i]));
+		particleInfo[i].inCollision = true;
 	}
 }
 
 // Apply forces to particles if they are colliding with the mesh geometry
 void FuzzyObject::applyBoundaryForces() {
+	if (!distanceField.empty()) {
+		applyDistanceFieldForces();
+		return;
+	}
+
 	// For each particle
-	for (int i = 0; i < particles.size(); i++) {
+	for (int i = 0; i < getParticleCount(); i++) {
+		fuzzyParticleInfo &info = particleInfo[i];
 
 		// If the particle is colliding with the intersection point
-		if (withinRange(particles[i].pos, particles[i].triangleIntersectionPos, p_boundaryRadius)) {
+		if (withinRange(particlePos.get(i), info.triangleIntersectionPos, p_boundaryRadius)) {
 		 	// Bounce the particle off the triangle surface by reflecting it's velocity
-			particles[i].vel = reflect(particles[i].vel, -(g_geometry->getSurfaceNormal(particles[i].triangleIndex))) * meshCollisionFriction;
-			particles[i].acc = vec3(0.0f, 0.0f, 0.0f);
+			particleVel.set(i, reflect(particleVel.get(i), -(g_geometry->getSurfaceNormal(info.triangleIndex))) * meshCollisionFriction);
+			particleAcc.set(i, vec3(0.0f, 0.0f, 0.0f));
 
 			// The particle is now facing the opposite direction so the facing triangle must be recomputed
 			updateFacingTriangle(i);
@@ -239,13 +595,30 @@ void FuzzyObject::applyBoundaryForces() {
 	}
 }
 
-// Returns the force that should be applied to two particles at a given distance
-//  between each other, based on the Lennard Jones potentials model
-vec3 FuzzyObject::forceAtDistance(float dist, vec3 distVector) {
-	float a = (48 * e_strength / pow(e_lengthScale, 2));
-	float b = pow(e_lengthScale / dist, 14);
-	float c = 0.5f * pow(e_lengthScale / dist, 8);
-	return a * (b - c) * distVector;
+// Apply boundary collisions using the distance field, where the field gradient
+// gives the outward surface normal at the particle
+void FuzzyObject::applyDistanceFieldForces() {
+	for (int i = 0; i < getParticleCount(); i++) {
+		vec3 pos = particlePos.get(i);
+
+		// If the particle is within the boundary radius of the surface
+		if (distanceField.sample(pos) > -p_boundaryRadius) {
+			// The gradient vanishes on flat spots in the field, where there is no normal to bounce off
+			vec3 gradient = distanceField.gradient(pos);
+			if (length(gradient) <= 0.0f) continue;
+
+			vec3 normal = normalize(gradient);
+			vec3 vel = particleVel.get(i);
+
+			// Bounce the particle off the surface if it is heading out of the mesh
+			if (dot(vel, normal) > 0.0f) {
+				particleVel.set(i, reflect(vel, normal) * meshCollisionFriction);
+				particleAcc.set(i, vec3(0.0f, 0.0f, 0.0f));
+			}
+
+			particleInfo[i].inCollision = true;
+		}
+	}
 }
 
 // Use the square distance to cut costs by avoiding square roots
@@ -257,32 +630,23 @@ bool FuzzyObject::withinRange(vec3 p1, vec3 p2, float range) {
 // Recompute the triangle the given particle is facing so collisions can be checked against it
 void FuzzyObject::updateFacingTriangle(int index) {
 	vec3 newIntersectionPoint = vec3(maxFloatVector);
-	float shortestLength = maxFloatVector.x;
-	int triangleIndex = 0;
 
-	// For each triangle
-	for (int i = 0; i < g_geometry->triangleCount(); i++) {
+	// Using the particle velocity as the direction vector
+	// Find the closest intersection point on the mesh triangles
+	int triangleIndex = g_geometry->raycastMesh(particlePos.get(index), particleVel.get(index), newIntersectionPoint);
 
-		// Using the particle velocity as the direction vector
-		// Compute the intersection point on the triangle
-		vec3 intersectionPoint = (g_geometry->rayIntersectsTriangle(particles[index].pos, particles[index].vel, i));
-
-		// Skip this triangle if no intersection occured
-		if (intersectionPoint.x == maxFloatVector.x) continue;
-
-		// If this is the closest intersection point yet
-		if (withinRange(particles[index].pos, intersectionPoint, shortestLength)) {
-			newIntersectionPoint = intersectionPoint;
-			shortestLength = length(particles[index].pos - newIntersectionPoint);
-			triangleIndex = i;
-		}
+	// No intersection occured
+	if (triangleIndex < 0) {
+		newIntersectionPoint = vec3(maxFloatVector);
+		triangleIndex = 0;
 	}
 
 	// Assign the final closest intersection point
-	particles[index].triangleIntersectionPos = newIntersectionPoint;
-	particles[index].triangleIndex = triangleIndex;
+	fuzzyParticleInfo &info = particleInfo[index];
+	info.triangleIntersectionPos = newIntersectionPoint;
+	info.triangleIndex = triangleIndex;
 
-	particles[index].inCollision = true;
+	info.inCollision = true;
 }
 
 void FuzzyObject::renderSystem() {
@@ -309,27 +673,35 @@ void FuzzyObject::renderSystem() {
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	glLineWidth(1);
 
-	for (int i = 0; i < particles.size(); i++) {
-		fuzzyParticle p = particles[i];
+	renderColours.resize(getParticleCount());
+	for (int i = 0; i < getParticleCount(); i++) {
+		renderColours[i] = particleInfo[i].col;
+	}
 
-		glPushMatrix();
-		glTranslatef(p.pos.x, p.pos.y, p.pos.z);
+	// Draw every particle in one call, positions are uploaded straight from the simulation arrays
+	renderer.render(particlePos, renderColours);
 
-		glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, p.col.dataPointer());
+	glPopMatrix();
+}
 
-		// Draw the particle
-		glCallList(p_displayList);
+void FuzzyObject::setRenderMode(particleRenderMode mode) {
+	renderer.setRenderMode(mode);
+}
 
-		glPopMatrix();
-	}
+int FuzzyObject::getParticleCount() {
+	return particlePos.size();
+}
 
-	glPopMatrix();
+float FuzzyObject::getParticleRadius() {
+	return p_radius;
+}
 
-	glEnd();
+int FuzzyObject::getBuildSteps() {
+	return buildSteps;
 }
 
-int FuzzyObject::getParticleCount() {
-	return particles.size();
+fuzzyConvergenceStats FuzzyObject::getConvergenceStats() {
+	return stats;
 }
 
 bool FuzzyObject::finishedBuilding() {
@@ -339,16 +711,20 @@ bool FuzzyObject::finishedBuilding() {
 // Return the complete particle system as a collection of point vectors
 vector<vec3> FuzzyObject::getSystem() {
 	vector<vec3> points;
+	points.reserve(getParticleCount());
 
-	for (int i = 0; i < particles.size(); i++) {
-		points.push_back(particles[i].pos);
+	for (int i = 0; i < getParticleCount(); i++) {
+		points.push_back(particlePos.get(i));
 	}
 
 	return points;
 }
 
 void FuzzyObject::clearParticles() {
-	particles.clear();
+	particlePos.clear();
+	particleVel.clear();
+	particleAcc.clear();
+	particleInfo.clear();
 }
 
 // Scales the algorithm paramaters to adjust the density of the resulting
@@ -359,8 +735,9 @@ void FuzzyObject::scaleDensity(float amount) {
 	p_spawnOffset *= amount;
 	e_lengthScale = min(e_lengthScale, e_lengthScale * max(amount * 1.5f, 1.0f));
 	e_effectRange = pow(2.0f, 1.0f / 6.0f) * e_lengthScale;
+	updatePotentialConstants();
 
-	setupDisplayList();
+	renderer.setRadius(p_radius);
 }
 
 // Used to hard code in some nice values for converting models quickly and fairly accurately
@@ -373,6 +750,7 @@ void FuzzyObject::setExampleSystemAttributes() {
 	e_strength = 0.005f;
 	e_lengthScale = 0.32f;
 	e_effectRange = pow(2.0f, 1.0f / 6.0f) * e_lengthScale;
+	updatePotentialConstants();
 
-	setupDisplayList();
+	renderer.setRadius(p_radius);
 }
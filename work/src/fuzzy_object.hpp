@@ -11,31 +11,46 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include "opengl.hpp"
+#include "distance_field.hpp"
 #include "geometry.hpp"
+#include "particle_renderer.hpp"
+#include "soa_vector.hpp"
 
-struct fuzzyParticle {
+// Cold per particle data, kept in a side table indexed in parallel with the
+// hot position, velocity and acceleration arrays of the FuzzyObject
+struct fuzzyParticleInfo {
 
-	// Basic properties
-	cgra::vec3 pos;
-	cgra::vec3 vel;
-	cgra::vec3 acc;
-	cgra::vec3 col; // Colour
+	cgra::vec3 col = cgra::vec3(1.0f, 1.0f, 1.0f); // Colour
 
 	// Collision properties
-	cgra::vec3 triangleIntersectionPos;
-	int triangleIndex;
-	bool inCollision;
+	cgra::vec3 triangleIntersectionPos = cgra::vec3();
+	int triangleIndex = 0;
+	bool inCollision = false;
 
 	// Neighbour relation properties
-	int id;
+	int id = 0;
 	std::vector<int> neighbours;
 };
 
+// How particles are introduced into the mesh while building
+enum class seedingMode {
+	incremental, // One particle per update from the spawn point
+	bulk         // Fill the mesh interior with a jittered lattice in one go
+};
+
+// Measurements of how settled the particle system is, updated every build step
+struct fuzzyConvergenceStats {
+	float kineticEnergy = 0.0f;   // Mean kinetic energy per particle
+	float maxDisplacement = 0.0f; // Furthest distance any particle moved in the last step
+	float fillRatio = 0.0f;       // Fraction of particles in collision
+};
+
 class FuzzyObject {
 
 	public:
@@ -43,17 +58,26 @@ class FuzzyObject {
 		cgra::vec3 spawnPoint = cgra::vec3(0, 0, 0);
 
 		// Constructors
-		FuzzyObject(Geometry*);
+		FuzzyObject(Geometry*, bool useDistanceField = false);
 		~FuzzyObject();
 
 		// Methods for building the system
 		void buildSystemIncrement();
 		void buildSystem(bool);
+		void setSeedingMode(seedingMode); // Only before the system starts building
 
 		// Misc methods
 		int getParticleCount();
+		float getParticleRadius();
+		int getBuildSteps();
+		fuzzyConvergenceStats getConvergenceStats();
 		void setExampleSystemAttributes();
 
+		// Load a system built before for the same mesh and parameters instead of building it,
+		// call once the parameters are set. Returns true if there was one, otherwise the system
+		// is written to the cache when it finishes building
+		bool loadCachedSystem();
+
 		// Methods for utilizing the built system
 		bool finishedBuilding();
 		std::vector<cgra::vec3> getSystem();
@@ -62,13 +86,22 @@ class FuzzyObject {
 
 		// Methods rendering the system
 		void renderSystem();
+		void setRenderMode(particleRenderMode);
 
 	private:
 		// The 3D object the particle system represents
 		Geometry* g_geometry;
 
-		// Particle system fields
-		std::vector<fuzzyParticle> particles;
+		// Optional signed distance field of the object used for boundary collisions
+		DistanceField distanceField;
+		int distanceFieldResolution = 32;
+
+		// Particle system fields, hot simulation state is stored as separate arrays
+		vec3Array particlePos;
+		vec3Array particleVel;
+		vec3Array particleAcc;
+		std::vector<fuzzyParticleInfo> particleInfo;
+		alignedVector<float> particleContacts; // Number of neighbours in range this update
 		int particleLimit = 3000;
 		int minParticleCount = 10;
 		std::vector<int> particlesForDeletion;
@@ -76,25 +109,43 @@ class FuzzyObject {
 
 		// State fields
 		bool buildFinished = false;
+		bool cached = false;
+		seedingMode seeding = seedingMode::incremental;
 
 		// Stopping criteria
 		bool firstPassFinished = false;
-		float stabilityUpdates = 10;
+		int stabilityUpdates = 10;
 		int collisionCount = 0;
 
+		// Convergence monitoring
+		fuzzyConvergenceStats stats;
+		int buildSteps = 0;
+		int settleSteps = 0;
+		int packedSteps = 0;  // Consecutive steps the fill ratio threshold was met
+		int restingSteps = 0; // Consecutive steps the rest thresholds were met
+		float fillRatioThreshold = 0.99f;
+		float restDisplacementScale = 0.1f; // Largest step at rest as a fraction of p_velRange
+		float restSpeedScale = 0.05f;       // RMS speed at rest as a fraction of p_velRange
+		int maxSettleSteps = 500;
+
 		// Particle attributes
-		GLuint p_displayList = 0;
 		float p_velRange = 0.033f;
 		float p_radius = 0.2f;
 		float p_boundaryRadius = 0.16f;
 		float p_mass = 100.0f;
 		float p_spawnOffset = 0.018f;
+		float p_latticeSpacing = 0.95f; // Bulk seeding spacing as a fraction of the LJ effect range
 
 		// LJ potential energy fields
 		float e_strength = 0.01f;
 		float e_lengthScale = 0.27f;
 		float e_effectRange = pow(2.0f, 1.0f / 6.0f) * e_lengthScale;
 
+		// Constants of the LJ force kernel derived from the fields above
+		float e_forceScale = 0.0f;
+		float e_lengthScaleSq = 0.0f;
+		float e_effectRangeSq = 0.0f;
+
 		// Physics fields
 		float meshCollisionFriction = 0.995f;
 		float particleCollisionFriction = 0.995f;
@@ -103,18 +154,26 @@ class FuzzyObject {
 		cgra::vec4 diffuse = cgra::vec4(0.8, 0.8, 0.8, 1.0);
 		cgra::vec4 specular = cgra::vec4(0.8, 0.8, 0.8, 1.0);
 		float shininess = 64.0f;
+		ParticleRenderer renderer;
+		std::vector<cgra::vec3> renderColours; // Colours gathered for upload each frame
 
 		cgra::vec3 maxFloatVector = cgra::vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
 
 		// Private methods for building the system
-		void setupDisplayList();
+		void finishBuilding();
+		uint64_t cacheKey();
 		bool stoppingCriteria();
 		bool systemAtRest();
 		void addParticle();
+		void insertParticle(cgra::vec3);
+		void seedParticles();
+		void removeParticles();
 		void updateBuildingSystem();
+		void updateConvergenceStats();
 		void applyParticleForces();
 		void applyBoundaryForces();
-		cgra::vec3 forceAtDistance(float, cgra::vec3);
+		void applyDistanceFieldForces();
+		void updatePotentialConstants();
 		bool withinRange(cgra::vec3, cgra::vec3, float);
 		void updateFacingTriangle(int);
 };
@@ -13,16 +13,28 @@
 //----------------------------------------------------------------------------
 
 #include <cmath>
-#include <iostream>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
-#include <sstream>
+#include <iostream>
+#include <memory>
 #include <string>
 #include <stdexcept>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "cgra_math.hpp"
+#include "file_cache.hpp"
 #include "geometry.hpp"
+#include "mapped_file.hpp"
 #include "opengl.hpp"
+#include "soa_vector.hpp"
+#include "text_parse.hpp"
+#include "thread_pool.hpp"
+#include "vertex_cache.hpp"
 
 using namespace std;
 using namespace cgra;
@@ -31,10 +43,8 @@ Geometry::Geometry(string filename, float texScale) {
 	m_filename = filename;
 	m_textureScale = texScale;
 	readOBJ(filename);
-	if (m_triangles.size() > 0) {
-		createDisplayListPoly();
-		createDisplayListWire();
-	}
+	computeBounds();
+	buildBVH();
 
 	// Default material setting
 	m_material.ambient = vec4(0.0f, 0.0f, 0.0f, 0.0f);
@@ -53,10 +63,8 @@ Geometry::Geometry(vector<vec3> points, vector<vec3> normals, vector<vec2> uvs,
 	// Create the surface normals for every triangle
 	if (genSurfaceNormals) createSurfaceNormals();
 
-	if (m_triangles.size() > 0) {
-		createDisplayListPoly();
-		createDisplayListWire();
-	}
+	computeBounds();
+	buildBVH();
 
 	// Default material setting
 	m_material.ambient = vec4(0.0f, 0.0f, 0.0f, 0.0f);
@@ -66,97 +74,294 @@ Geometry::Geometry(vector<vec3> points, vector<vec3> normals, vector<vec2> uvs,
 	m_material.emission = vec4(0.0f, 0.0f, 0.0f, 0.0f);
 }
 
-Geometry::~Geometry() { }
+Geometry::~Geometry() {
+	deleteVertexBuffers();
+}
 
-void Geometry::readOBJ(string filename) {
+// Identifies the binary layout of cached mesh files
+static const uint32_t meshFileMagic = 0x3248534D; // "MSH2"
+
+// Start of a cached mesh file, followed by the points, uvs, normals, triangles and
+// surface normals exactly as they are laid out in memory
+struct meshFileHeader {
+	uint32_t magic;
+	int triangles;
+	uint64_t sourceSize; // Size and modification time of the OBJ file the mesh was read from
+	int64_t sourceModified;
+	int points;
+	int uvs;
+	int normals;
+	int reserved;
+};
+
+// Files are split into chunks of about this many bytes to parse in parallel
+static const size_t objChunkSize = 1 << 20;
+
+// A piece of an OBJ file made of whole lines, with the number of each element in it
+// and the index its first element of each kind has in the whole file
+struct objChunk {
+	const char *begin;
+	const char *end;
+	int points = 0;
+	int uvs = 0;
+	int normals = 0;
+	int triangles = 0;
+	int firstPoint = 0;
+	int firstUv = 0;
+	int firstNormal = 0;
+	int firstTriangle = 0;
+};
+
+// Where a chunk writes its elements, null when only counting them
+struct objOutput {
+	vec3 *points;
+	vec2 *uvs;
+	vec3 *normals;
+	triangle *triangles;
+};
+
+// Parse the lines of a chunk, counting its elements or writing them out. Both passes
+// share this so the counts always agree with what is written
+static void parseOBJChunk(objChunk &chunk, const objOutput *out) {
+	const char *c = chunk.begin;
+	const char *end = chunk.end;
+	int points = 0;
+	int uvs = 0;
+	int normals = 0;
+	int triangles = 0;
+
+	while (c < end) {
+
+		// Whitespace at the start of the line is fine, and empty lines are skipped
+		c = skipBlanks(c, end);
+		const char *mode = c;
+		while (c < end && !isBlank(*c) && *c != '\n') c++;
+		size_t modeLength = c - mode;
+
+		if (modeLength == 1 && mode[0] == 'v') {
+			if (out) {
+				vec3 &v = out->points[points];
+				c = parseFloat(skipBlanks(c, end), end, v.x);
+				c = parseFloat(skipBlanks(c, end), end, v.y);
+				c = parseFloat(skipBlanks(c, end), end, v.z);
+			}
+			points++;
+
+		} else if (modeLength == 2 && mode[0] == 'v' && mode[1] == 'n') {
+			if (out) {
+				vec3 &vn = out->normals[normals];
+				c = parseFloat(skipBlanks(c, end), end, vn.x);
+				c = parseFloat(skipBlanks(c, end), end, vn.y);
+				c = parseFloat(skipBlanks(c, end), end, vn.z);
+			}
+			normals++;
 
-	// Make sure our geometry information is cleared
-	m_points.clear();
-	m_uvs.clear();
-	m_normals.clear();
-	m_triangles.clear();
+		} else if (modeLength == 2 && mode[0] == 'v' && mode[1] == 't') {
+			if (out) {
+				vec2 &vt = out->uvs[uvs];
+				c = parseFloat(skipBlanks(c, end), end, vt.x);
+				c = parseFloat(skipBlanks(c, end), end, vt.y);
+			}
+			uvs++;
+
+		} else if (modeLength == 1 && mode[0] == 'f') {
+
+			// Each corner is formatted as v, v/vt, v//vn or v/vt/vn. Polygons with more
+			// than 3 corners are split into a fan of triangles around the first corner
+			vertex first;
+			vertex previous;
+			int vertCount = 0;
+			c = skipBlanks(c, end);
+			while (c < end && *c != '\n') {
+				vertex v;
+				const char *corner = c;
+				c = parseInt(c, end, v.p);
+				if (c < end && *c == '/') {
+					c = parseInt(c + 1, end, v.t);
+					if (c < end && *c == '/') c = parseInt(c + 1, end, v.n);
+				}
 
-	// Load dummy points because OBJ indexing starts at 1 not 0
-	m_points.push_back(vec3(0,0,0));
-	m_uvs.push_back(vec2(0,0));
-	m_normals.push_back(vec3(0,0,1));
+				// Stop at anything that is not a corner
+				if (c == corner) break;
+
+				// Negative indices count back from the last element read before this face
+				if (v.p < 0) v.p += chunk.firstPoint + points;
+				if (v.t < 0) v.t += chunk.firstUv + uvs;
+				if (v.n < 0) v.n += chunk.firstNormal + normals;
+
+				if (vertCount >= 2) {
+					if (out) {
+						triangle &tri = out->triangles[triangles];
+						tri.v[0] = first;
+						tri.v[1] = previous;
+						tri.v[2] = v;
+					}
+					triangles++;
+				}
 
-	ifstream objFile(filename);
+				if (vertCount == 0) first = v;
+				previous = v;
+				vertCount++;
+				c = skipBlanks(c, end);
+			}
+		}
 
-	if(!objFile.is_open()) {
-		cerr << "Error reading " << filename << endl;
-		throw runtime_error("Error :: could not open file.");
+		c = skipLine(c, end);
 	}
 
-	cout << "Reading file " << filename << endl;
+	chunk.points = points;
+	chunk.uvs = uvs;
+	chunk.normals = normals;
+	chunk.triangles = triangles;
+}
 
-	// good() means that failbit, badbit and eofbit are all not set
-	while(objFile.good()) {
+// Cached meshes are written beside the OBJ file they were read from
+static string meshCachePath(const string &filename) {
+	return filename + ".mesh";
+}
 
-		// Pull out line from file
-		string line;
-		std::getline(objFile, line);
-		istringstream objLine(line);
+// Load the mesh cached for the given OBJ file, returns false if there is none or the OBJ has changed since
+bool Geometry::readMeshCache(string filename) {
+	uint64_t sourceSize = 0;
+	int64_t sourceModified = 0;
+	if (!fileStamp(filename, sourceSize, sourceModified)) return false;
+
+	unique_ptr<MappedFile> meshFile;
+	try {
+		meshFile.reset(new MappedFile(meshCachePath(filename)));
+	} catch (const runtime_error&) {
+		return false;
+	}
 
-		// Pull out mode from line
-		string mode;
-		objLine >> mode;
+	meshFileHeader header;
+	if (meshFile->size() < sizeof(header)) return false;
+	memcpy(&header, meshFile->data(), sizeof(header));
 
-		// Reading like this means whitespace at the start of the line is fine
-		// attempting to read from an empty string/line will set the failbit
-		if (!objLine.fail()) {
+	if (header.magic != meshFileMagic || header.sourceSize != sourceSize || header.sourceModified != sourceModified) return false;
+	if (header.points < 1 || header.uvs < 1 || header.normals < 1 || header.triangles < 0) return false;
 
-			if (mode == "v") {
-				vec3 v;
-				objLine >> v.x >> v.y >> v.z;
-				m_points.push_back(v);
+	size_t expectedSize = sizeof(header) + header.points * sizeof(vec3) + header.uvs * sizeof(vec2) +
+		header.normals * sizeof(vec3) + header.triangles * (sizeof(triangle) + sizeof(vec3));
+	if (meshFile->size() != expectedSize) return false;
 
-			} else if(mode == "vn") {
-				vec3 vn;
-				objLine >> vn.x >> vn.y >> vn.z;
-				m_normals.push_back(vn);
+	// Each array is copied straight out of the mapping, there is nothing left to compute
+	const char *c = meshFile->data() + sizeof(header);
+	const vec3 *points = reinterpret_cast<const vec3*>(c);
+	m_points.assign(points, points + header.points);
+	c += header.points * sizeof(vec3);
 
-			} else if(mode == "vt") {
-				vec2 vt;
-				objLine >> vt.x >> vt.y;
-				m_uvs.push_back(vt);
+	const vec2 *uvs = reinterpret_cast<const vec2*>(c);
+	m_uvs.assign(uvs, uvs + header.uvs);
+	c += header.uvs * sizeof(vec2);
 
-			} else if(mode == "f") {
+	const vec3 *normals = reinterpret_cast<const vec3*>(c);
+	m_normals.assign(normals, normals + header.normals);
+	c += header.normals * sizeof(vec3);
 
-				vector<vertex> verts;
-				while (objLine.good()){
-					vertex v;
+	const triangle *triangles = reinterpret_cast<const triangle*>(c);
+	m_triangles.assign(triangles, triangles + header.triangles);
+	c += header.triangles * sizeof(triangle);
 
-					objLine >> v.p;		// Scan in position index
+	const vec3 *surfaceNormals = reinterpret_cast<const vec3*>(c);
+	m_surfaceNormals.assign(surfaceNormals, surfaceNormals + header.triangles);
 
-					// Check if the obj file contains normal data
-					if (m_normals.size() > 1) {
-						// obj face is formatted as v/vt/vn or v//vn
-						objLine.ignore(1);	// Ignore the '/' character
+	cout << "Loaded cached mesh for " << filename << endl;
+	return true;
+}
 
-						if (m_uvs.size() > 1) { // Check if the obj file contains uv data
-							objLine >> v.t;		// Scan in uv (texture coord) index
-						}
-						objLine.ignore(1);	// Ignore the '/' character
+// Store the mesh beside its OBJ file, stamped with the OBJ size and modification time
+void Geometry::writeMeshCache(string filename) {
+	meshFileHeader header = {};
+	header.magic = meshFileMagic;
+	header.triangles = m_triangles.size();
+	header.points = m_points.size();
+	header.uvs = m_uvs.size();
+	header.normals = m_normals.size();
+	if (!fileStamp(filename, header.sourceSize, header.sourceModified)) return;
+
+	string path = meshCachePath(filename);
+	ofstream file(path, ios::binary);
+	if (!file.is_open()) {
+		cerr << "Could not write mesh cache " << path << endl;
+		return;
+	}
 
-						objLine >> v.n;		// Scan in normal index
-					} // Else the obj face is formatted just as v
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(m_points.data()), m_points.size() * sizeof(vec3));
+	file.write(reinterpret_cast<const char*>(m_uvs.data()), m_uvs.size() * sizeof(vec2));
+	file.write(reinterpret_cast<const char*>(m_normals.data()), m_normals.size() * sizeof(vec3));
+	file.write(reinterpret_cast<const char*>(m_triangles.data()), m_triangles.size() * sizeof(triangle));
+	file.write(reinterpret_cast<const char*>(m_surfaceNormals.data()), m_surfaceNormals.size() * sizeof(vec3));
+}
 
-					verts.push_back(v);
-				}
+void Geometry::readOBJ(string filename) {
 
-				// If we have 3 verticies, construct a triangle
-				if(verts.size() >= 3){
-					triangle tri;
-					tri.v[0] = verts[0];
-					tri.v[1] = verts[1];
-					tri.v[2] = verts[2];
-					m_triangles.push_back(tri);
-				}
-			}
-		}
+	// A cached copy of the parsed mesh is much quicker to load than the OBJ text
+	if (readMeshCache(filename)) return;
+
+	// Map the file and parse it in place, rather than copying each line out of a stream
+	unique_ptr<MappedFile> objFile;
+	try {
+		objFile.reset(new MappedFile(filename));
+	} catch (const runtime_error&) {
+		cerr << "Error reading " << filename << endl;
+		throw;
 	}
 
+	cout << "Reading file " << filename << endl;
+
+	// Split the file into chunks that each start at the beginning of a line
+	const char *c = objFile->data();
+	const char *end = c + objFile->size();
+	vector<objChunk> chunks;
+	while (c < end) {
+		objChunk chunk;
+		chunk.begin = c;
+		c = size_t(end - c) > objChunkSize ? skipLine(c + objChunkSize, end) : end;
+		chunk.end = c;
+		chunks.push_back(chunk);
+	}
+
+	// Count the elements of every chunk in parallel
+	ThreadPool::shared().parallelFor(chunks.size(), 1, [&chunks](int begin, int, int) {
+		parseOBJChunk(chunks[begin], nullptr);
+	});
+
+	// A running total of the counts gives where each chunk's elements go. Everything
+	// starts at 1 after a dummy element, because OBJ indexing starts at 1 not 0
+	int points = 1;
+	int uvs = 1;
+	int normals = 1;
+	int triangles = 0;
+	for (objChunk &chunk : chunks) {
+		chunk.firstPoint = points;
+		chunk.firstUv = uvs;
+		chunk.firstNormal = normals;
+		chunk.firstTriangle = triangles;
+		points += chunk.points;
+		uvs += chunk.uvs;
+		normals += chunk.normals;
+		triangles += chunk.triangles;
+	}
+
+	// Make sure our geometry information is cleared, then size it to fit everything at once
+	m_points.assign(points, vec3(0, 0, 0));
+	m_uvs.assign(uvs, vec2(0, 0));
+	m_normals.assign(normals, vec3(0, 0, 1));
+	m_triangles.assign(triangles, triangle());
+
+	// Parse every chunk again in parallel, writing its elements straight into place
+	ThreadPool::shared().parallelFor(chunks.size(), 1, [&](int begin, int, int) {
+		objChunk &chunk = chunks[begin];
+		objOutput out = {
+			m_points.data() + chunk.firstPoint,
+			m_uvs.data() + chunk.firstUv,
+			m_normals.data() + chunk.firstNormal,
+			m_triangles.data() + chunk.firstTriangle
+		};
+		parseOBJChunk(chunk, &out);
+	});
+
 	// Create the surface normals for every triangle
 	createSurfaceNormals();
 
@@ -168,102 +373,329 @@ void Geometry::readOBJ(string filename) {
 	cout << m_uvs.size()-1 << " uv coords" << endl;
 	cout << m_normals.size()-1 << " normals" << endl;
 	cout << m_triangles.size() << " faces" << endl;
+
+	writeMeshCache(filename);
 }
 
-void Geometry::createNormals() {
-	// Maintain a collection of each vertex normal
-	vector<vec3> vertex_normals(m_points.size());
+// Normals are generated in chunks of this many triangles or points across the thread
+// pool, a multiple of the SIMD width so every chunk starts on an aligned element
+static const int normalChunkSize = 4096;
 
-	for (int i = 0; i < m_triangles.size(); i++) {
-		vec3 v1 = m_points[m_triangles[i].v[0].p];
-		vec3 v2 = m_points[m_triangles[i].v[1].p];
-		vec3 v3 = m_points[m_triangles[i].v[2].p];
+// Unnormalized normal of a triangle, its length is twice the triangle's area
+static inline vec3 faceNormal(const vector<vec3> &points, const triangle &tri) {
+	vec3 p0 = points[tri.v[0].p];
+	return cross(points[tri.v[1].p] - p0, points[tri.v[2].p] - p0);
+}
+
+// Normalize vectors [begin, end) in place, replacing zero length vectors with the fallback.
+// Matches normalize exactly, dividing each component by the length
+static void normalizeVectorsScalar(int begin, int end, float *x, float *y, float *z, vec3 fallback) {
+	for (int i = begin; i < end; i++) {
+		float l = std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+		bool valid = l > 0.0f;
+		x[i] = valid ? x[i] / l : fallback.x;
+		y[i] = valid ? y[i] / l : fallback.y;
+		z[i] = valid ? z[i] / l : fallback.z;
+	}
+}
+
+#ifdef __AVX2__
+// Normalize vectors [begin, end) eight at a time, begin must be a multiple of 8 so the loads stay aligned
+static void normalizeVectors(int begin, int end, float *x, float *y, float *z, vec3 fallback) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 fx = _mm256_set1_ps(fallback.x);
+	const __m256 fy = _mm256_set1_ps(fallback.y);
+	const __m256 fz = _mm256_set1_ps(fallback.z);
+
+	int i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256 vx = _mm256_load_ps(x + i);
+		__m256 vy = _mm256_load_ps(y + i);
+		__m256 vz = _mm256_load_ps(z + i);
+		__m256 l = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz)));
+		__m256 valid = _mm256_cmp_ps(l, zero, _CMP_GT_OQ);
+		_mm256_store_ps(x + i, _mm256_blendv_ps(fx, _mm256_div_ps(vx, l), valid));
+		_mm256_store_ps(y + i, _mm256_blendv_ps(fy, _mm256_div_ps(vy, l), valid));
+		_mm256_store_ps(z + i, _mm256_blendv_ps(fz, _mm256_div_ps(vz, l), valid));
+	}
 
-		// Compute the surface normal from the triangle vertices
-		vec3 n = cross(v2 - v1, v3 - v1);
+	normalizeVectorsScalar(i, end, x, y, z, fallback);
+}
+#else
+static void normalizeVectors(int begin, int end, float *x, float *y, float *z, vec3 fallback) {
+	normalizeVectorsScalar(begin, end, x, y, z, fallback);
+}
+#endif
 
-		// Add the surface normal to each associated vertex normal
+void Geometry::createNormals() {
+	// Kept interleaved, as each point reads all three components of the faces around it
+	vector<vec3> faceNormals(m_triangles.size());
+	ThreadPool::shared().parallelFor(m_triangles.size(), normalChunkSize, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			faceNormals[i] = faceNormal(m_points, m_triangles[i]);
+		}
+	});
+
+	// List the triangles around each point, in triangle order, so every point can sum its
+	// own face normals instead of each triangle adding into shared points
+	vector<int> firstFace(m_points.size() + 1, 0);
+	for (const triangle &tri : m_triangles) {
 		for (int j = 0; j < 3; j++) {
-			vertex_normals[m_triangles[i].v[j].p] += n;
+			firstFace[tri.v[j].p + 1]++;
 		}
 	}
+	for (int i = 0; i < m_points.size(); i++) {
+		firstFace[i + 1] += firstFace[i];
+	}
 
+	vector<int> pointFaces(m_triangles.size() * 3);
+	vector<int> filled(firstFace.begin(), firstFace.end() - 1);
 	for (int i = 0; i < m_triangles.size(); i++) {
 		for (int j = 0; j < 3; j++) {
-			// Push the normalized vertex normal to the model normals
-			vec3 v_normal = vertex_normals[m_triangles[i].v[j].p];
-			m_normals.push_back(normalize(v_normal));
+			pointFaces[filled[m_triangles[i].v[j].p]++] = i;
+		}
+	}
+
+	// Store one normalized normal per point, so corners sharing a point can share a vertex
+	vec3Array pointNormals;
+	pointNormals.resize(m_points.size());
+	m_normals.resize(m_points.size());
+
+	ThreadPool::shared().parallelFor(m_points.size(), normalChunkSize, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			float x = 0.0f;
+			float y = 0.0f;
+			float z = 0.0f;
+			for (int k = firstFace[i]; k < firstFace[i + 1]; k++) {
+				const vec3 &n = faceNormals[pointFaces[k]];
+				x += n.x;
+				y += n.y;
+				z += n.z;
+			}
+			pointNormals.x[i] = x;
+			pointNormals.y[i] = y;
+			pointNormals.z[i] = z;
+		}
+
+		normalizeVectors(begin, end, pointNormals.x.data(), pointNormals.y.data(), pointNormals.z.data(), vec3(0.0f, 0.0f, 1.0f));
+		for (int i = begin; i < end; i++) {
+			m_normals[i] = pointNormals.get(i);
+		}
+	});
 
-			// Associate the current vertex with the new vertex normal
-			m_triangles[i].v[j].n = m_normals.size() - 1;
+	// Associate each vertex with the normal of its point
+	for (int i = 0; i < m_triangles.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			m_triangles[i].v[j].n = m_triangles[i].v[j].p;
 		}
 	}
 }
 
 void Geometry::createSurfaceNormals() {
-	// Compute the surface normal of each triangle
+	// Compute the surface normal of each triangle, degenerate triangles get a zero normal
+	vec3Array faceNormals;
+	faceNormals.resize(m_triangles.size());
+	m_surfaceNormals.resize(m_triangles.size());
+
+	ThreadPool::shared().parallelFor(m_triangles.size(), normalChunkSize, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			faceNormals.set(i, faceNormal(m_points, m_triangles[i]));
+		}
+
+		normalizeVectors(begin, end, faceNormals.x.data(), faceNormals.y.data(), faceNormals.z.data(), vec3(0.0f, 0.0f, 0.0f));
+		for (int i = begin; i < end; i++) {
+			m_surfaceNormals[i] = faceNormals.get(i);
+		}
+	});
+}
+
+// Compute the axis aligned bounding box of the mesh points
+void Geometry::computeBounds() {
+	float inf = numeric_limits<float>::max();
+	m_minBounds = vec3(inf, inf, inf);
+	m_maxBounds = vec3(-inf, -inf, -inf);
+
+	// Skip the dummy point at index 0
+	for (int i = 1; i < m_points.size(); i++) {
+		m_minBounds = cgra::min(m_minBounds, m_points[i]);
+		m_maxBounds = cgra::max(m_maxBounds, m_points[i]);
+	}
+
+	if (m_points.size() <= 1) {
+		m_minBounds = vec3(0.0f, 0.0f, 0.0f);
+		m_maxBounds = vec3(0.0f, 0.0f, 0.0f);
+	}
+}
+
+// Build the ray casting acceleration structure over the triangles
+void Geometry::buildBVH() {
+	vector<vec3> corners;
+	corners.reserve(m_triangles.size() * 3);
+
 	for (int i = 0; i < m_triangles.size(); i++) {
-		vec3 surfaceNormal = cross(m_points[m_triangles[i].v[1].p] - m_points[m_triangles[i].v[0].p],
-			 																	m_points[m_triangles[i].v[2].p] - m_points[m_triangles[i].v[0].p]);
-		m_surfaceNormals.push_back(normalize(surfaceNormal));
+		for (int j = 0; j < 3; j++) {
+			corners.push_back(m_points[m_triangles[i].v[j].p]);
+		}
 	}
+
+	m_bvh.build(corners);
 }
 
-void Geometry::createDisplayListPoly() {
-	// Delete old list if there is one
-	if (m_displayListPoly) glDeleteLists(m_displayListPoly, 1);
+// Weld triangle corners that share a point, uv and normal into single vertices indexed
+// by corner, so each shared vertex is only stored and transformed once. Only touches
+// memory, so geometry can be built away from the thread that owns the GL context.
+// Done on the first draw otherwise, so geometry that is never drawn skips it
+void Geometry::buildVertexData() {
+	if (m_indexCount > 0 || m_triangles.empty()) return;
 
-	// Create a new list
-	//cout << "Creating Poly Geometry" << endl;
-	m_displayListPoly = glGenLists(1);
-	glNewList(m_displayListPoly, GL_COMPILE);
+	int cornerCount = m_triangles.size() * 3;
+	vector<uint32_t> indices(cornerCount);
+	vector<vertex> vertices;
 
-	displayTriangles();
+	// Bucket the corners by point, so each corner is only compared with others on the same point
+	vector<int> firstCorner(m_points.size() + 2, 0);
+	for (triangle &tri : m_triangles) {
+		for (int j = 0; j < 3; j++) {
+			if (size_t(tri.v[j].p) >= m_points.size()) tri.v[j].p = 0;
+			firstCorner[tri.v[j].p + 2]++;
+		}
+	}
+	for (size_t i = 2; i < firstCorner.size(); i++) {
+		firstCorner[i] += firstCorner[i - 1];
+	}
+
+	vector<int> pointCorners(cornerCount);
+	for (int c = 0; c < cornerCount; c++) {
+		pointCorners[firstCorner[m_triangles[c / 3].v[c % 3].p + 1]++] = c;
+	}
+
+	for (size_t p = 0; p < m_points.size(); p++) {
+		int firstVertex = vertices.size();
+		for (int k = firstCorner[p]; k < firstCorner[p + 1]; k++) {
+			int c = pointCorners[k];
+			const vertex &v = m_triangles[c / 3].v[c % 3];
+
+			int index = firstVertex;
+			while (index < vertices.size() && (vertices[index].t != v.t || vertices[index].n != v.n)) index++;
+			if (index == vertices.size()) vertices.push_back(v);
+
+			indices[c] = index;
+		}
+	}
+
+	optimizeVertexCache(indices, vertices.size());
+
+	// Number the vertices in the order they are first drawn, so they are also fetched in order
+	vector<int> order(vertices.size(), -1);
+	int vertexCount = 0;
+	for (uint32_t &index : indices) {
+		if (order[index] < 0) order[index] = vertexCount++;
+		index = order[index];
+	}
+
+	m_meshVertices.resize(vertexCount);
+	for (int i = 0; i < vertices.size(); i++) {
+		const vertex &v = vertices[i];
+		meshVertex &m = m_meshVertices[order[i]];
+		m.position = m_points[v.p];
+		m.normal = size_t(v.n) < m_normals.size() ? m_normals[v.n] : vec3(0.0f, 0.0f, 1.0f);
+		m.uv = (size_t(v.t) < m_uvs.size() ? m_uvs[v.t] : vec2(0.0f, 0.0f)) * m_textureScale;
+	}
+
+	m_meshIndices.swap(indices);
+	m_indexCount = m_meshIndices.size();
+}
+
+// Vertex array objects need OpenGL 3.0 or the extension, legacy contexts such as the
+// default one on macOS set the vertex layout up on every draw instead
+bool Geometry::vertexArraysSupported() {
+	return GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object;
+}
 
-	glEndList();
-	//cout << "Finished creating Poly Geometry" << endl;
+// Point the fixed function attributes at the interleaved vertex buffer, which must be bound
+void Geometry::setVertexPointers() {
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(meshVertex), (const GLvoid*) offsetof(meshVertex, position));
+	glNormalPointer(GL_FLOAT, sizeof(meshVertex), (const GLvoid*) offsetof(meshVertex, normal));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(meshVertex), (const GLvoid*) offsetof(meshVertex, uv));
 }
 
-void Geometry::createDisplayListWire() {
-	// Delete old list if there is one
-	if (m_displayListWire) glDeleteLists(m_displayListWire, 1);
+// Upload the welded vertices interleaved with their index buffer, recording the layout
+// in a vertex array object when there are those. The copies in memory are released once
+// they are on the GPU
+void Geometry::createVertexBuffers() {
+	deleteVertexBuffers();
 
-	// Create a new list
-	//cout << "Creating Wire Geometry" << endl;
-	m_displayListWire = glGenLists(1);
-	glNewList(m_displayListWire, GL_COMPILE);
+	// The index buffer binding is part of the vertex array state, so it is bound while recording
+	if (vertexArraysSupported()) {
+		glGenVertexArrays(1, &m_vertexArray);
+		glBindVertexArray(m_vertexArray);
+	}
+
+	glGenBuffers(1, &m_vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, m_meshVertices.size() * sizeof(meshVertex), m_meshVertices.data(), GL_STATIC_DRAW);
+
+	if (m_vertexArray) setVertexPointers();
+
+	// Small meshes get away with half size indices
+	glGenBuffers(1, &m_indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	if (m_meshVertices.size() <= 65536) {
+		vector<uint16_t> shortIndices(m_meshIndices.begin(), m_meshIndices.end());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+		m_indexType = GL_UNSIGNED_SHORT;
+	} else {
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_meshIndices.size() * sizeof(uint32_t), m_meshIndices.data(), GL_STATIC_DRAW);
+		m_indexType = GL_UNSIGNED_INT;
+	}
 
-	displayTriangles();
+	if (m_vertexArray) glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-	glEndList();
-	//cout << "Finished creating Wire Geometry" << endl;
+	vector<meshVertex>().swap(m_meshVertices);
+	vector<uint32_t>().swap(m_meshIndices);
 }
 
-void Geometry::displayTriangles() {
-	glBegin(GL_TRIANGLES);
-	for (int i = 0; i < m_triangles.size(); i++) {
-		for (int j = 0; j < 3; j++) {
-			int p_index = m_triangles[i].v[j].p;
-			int t_index = m_triangles[i].v[j].t;
-			int n_index = m_triangles[i].v[j].n;
+void Geometry::deleteVertexBuffers() {
+	if (!m_vertexBuffer) return;
 
-			if (n_index < m_normals.size()) {
-				vec3 n = m_normals[n_index];
-				glNormal3f(n.x, n.y, n.z);
-			}
+	GLuint buffers[] = { m_vertexBuffer, m_indexBuffer };
+	glDeleteBuffers(2, buffers);
+	if (m_vertexArray) glDeleteVertexArrays(1, &m_vertexArray);
 
-			if (t_index < m_uvs.size()) {
-				vec2 t = m_uvs[t_index];
-				glTexCoord2f(t.x * m_textureScale, t.y * m_textureScale);
-			}
+	m_vertexArray = m_vertexBuffer = m_indexBuffer = 0;
+}
 
-			if (p_index < m_points.size()) {
-				vec3 p = m_points[p_index];
-				glVertex3f(p.x, p.y, p.z);
-			}
-		}
+void Geometry::drawTriangles() {
+	if (m_triangles.empty()) return;
+
+	// Buffers are created on first use so the geometry can be built on any thread
+	if (!m_vertexBuffer) {
+		buildVertexData();
+		createVertexBuffers();
 	}
-	glEnd();
+
+	if (m_vertexArray) {
+		glBindVertexArray(m_vertexArray);
+		glDrawElements(GL_TRIANGLES, m_indexCount, m_indexType, (const GLvoid*) 0);
+		glBindVertexArray(0);
+		return;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	setVertexPointers();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	glDrawElements(GL_TRIANGLES, m_indexCount, m_indexType, (const GLvoid*) 0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 }
 
 vec3 Geometry::getPosition() {
@@ -325,20 +757,120 @@ vec3 Geometry::rayIntersectsTriangle(vec3 p, vec3 d, int triIndex) {
 	return noIntersectionVector;
 }
 
+// Performs a ray cast from the given point in the given direction against every triangle
+// Returns the index of the closest triangle hit, or -1 if none was, and the intersection point
+int Geometry::raycastMesh(vec3 p, vec3 d, vec3 &intersectionPoint) {
+	return m_bvh.raycast(p, d, intersectionPoint);
+}
+
 // Determines if a given point lies within the mesh geometry
 bool Geometry::pointInsideMesh(vec3 point) {
-	int intersectionCount = 0;
 
-	vec3 direction = vec3(0, 0, 1);
+	// Rays along a single axis are easily fooled by hitting a shared edge or vertex twice,
+	// so take a majority vote over a few skewed directions
+	static const vec3 directions[3] = {
+		vec3(0.1735f, 0.0731f, 0.9821f),
+		vec3(-0.5773f, 0.8112f, -0.0931f),
+		vec3(0.7071f, -0.4472f, -0.5477f)
+	};
+
+	int insideVotes = 0;
+	for (int i = 0; i < 3; i++) {
+
+		// An odd number of intersections means the point is inside the mesh
+		if (m_bvh.countCrossings(point, directions[i]) % 2) insideVotes++;
+	}
+
+	return insideVotes >= 2;
+}
+
+// Determines if a given point lies within the mesh geometry using the cached winding number
+// grid when it has been built, otherwise falls back to ray casting
+bool Geometry::pointInsideMeshFast(vec3 point) {
+	if (m_windingGrid.empty()) return pointInsideMesh(point);
+
+	// Find the grid cell containing the point
+	vec3 g = (point - m_gridMin) / m_gridCellSize;
+	int n = m_gridResolution;
+	if (g.x < 0.0f || g.y < 0.0f || g.z < 0.0f || g.x >= n || g.y >= n || g.z >= n) return false;
+
+	int x = int(g.x), y = int(g.y), z = int(g.z);
+	float fx = g.x - x, fy = g.y - y, fz = g.z - z;
+
+	// Trilinearly interpolate the winding numbers at the cell corners
+	int stride = n + 1;
+	auto at = [&](int i, int j, int k) { return m_windingGrid[(k * stride + j) * stride + i]; };
+	auto lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+
+	float c00 = lerp(at(x, y, z), at(x + 1, y, z), fx);
+	float c10 = lerp(at(x, y + 1, z), at(x + 1, y + 1, z), fx);
+	float c01 = lerp(at(x, y, z + 1), at(x + 1, y, z + 1), fx);
+	float c11 = lerp(at(x, y + 1, z + 1), at(x + 1, y + 1, z + 1), fx);
+	float w = lerp(lerp(c00, c10, fy), lerp(c01, c11, fy), fz);
+
+	return w > 0.5f;
+}
+
+// Computes the generalized winding number of the mesh around the given point
+// This is close to 1 inside a closed mesh and 0 outside, and unlike ray parity
+// it is not affected by edge hits or small holes in the mesh
+float Geometry::windingNumber(vec3 point) {
+	float total = 0.0f;
 
 	for (int i = 0; i < m_triangles.size(); i++) {
-		if (rayIntersectsTriangle(point, direction, i).x != noIntersectionVector.x) {
-			intersectionCount++;
+		vec3 a = m_points[m_triangles[i].v[0].p] - point;
+		vec3 b = m_points[m_triangles[i].v[1].p] - point;
+		vec3 c = m_points[m_triangles[i].v[2].p] - point;
+
+		float la = length(a), lb = length(b), lc = length(c);
+
+		// Solid angle of the triangle as seen from the point
+		float numerator = dot(a, cross(b, c));
+		float denominator = la * lb * lc + dot(a, b) * lc + dot(a, c) * lb + dot(b, c) * la;
+		total += 2.0f * atan2(numerator, denominator);
+	}
+
+	// Orientation of the mesh winding does not matter for inside tests
+	return abs(total) / (4.0f * math::pi());
+}
+
+// Precompute the winding number of the mesh at the corners of a grid covering it
+// so that repeated inside / outside queries become a constant time lookup
+void Geometry::buildOccupancyGrid(int resolution) {
+	m_gridResolution = resolution;
+
+	// Pad the grid by a cell so points just outside the bounds interpolate to outside
+	vec3 extent = m_maxBounds - m_minBounds;
+	vec3 padding = extent / float(resolution - 2);
+	m_gridMin = m_minBounds - padding;
+	m_gridCellSize = (extent + padding * 2.0f) / float(resolution);
+
+	int stride = resolution + 1;
+	m_windingGrid.assign(stride * stride * stride, 0.0f);
+
+	for (int k = 0; k < stride; k++) {
+		for (int j = 0; j < stride; j++) {
+			for (int i = 0; i < stride; i++) {
+				vec3 point = m_gridMin + vec3(i, j, k) * m_gridCellSize;
+				m_windingGrid[(k * stride + j) * stride + i] = windingNumber(point);
+			}
 		}
 	}
+}
+
+bool Geometry::hasOccupancyGrid() {
+	return !m_windingGrid.empty();
+}
 
-	// An odd number of intersections means the point is inside the mesh
-	return intersectionCount % 2;
+// Returns the unsigned distance from the point to the closest point on the mesh surface
+float Geometry::closestDistance(vec3 point) {
+	return m_bvh.closestDistance(point);
+}
+
+// Hash of the mesh shape, used to key data derived from it in the disk cache
+uint64_t Geometry::hash() {
+	uint64_t h = hashBytes(m_points.data(), m_points.size() * sizeof(vec3));
+	return hashBytes(m_triangles.data(), m_triangles.size() * sizeof(triangle), h);
 }
 
 void Geometry::renderGeometry(bool wireframe) {
@@ -358,11 +890,10 @@ void Geometry::renderGeometry(bool wireframe) {
 	if (wireframe) {
 		glLineWidth(1);
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glCallList(m_displayListWire);
 	} else {
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		glCallList(m_displayListPoly);
 	}
+	drawTriangles();
 
 	// Debug code for drawing the surface normals
 	// for (int i = 0; i < m_surfaceNormals.size(); i++) {
@@ -393,6 +924,14 @@ vec3 Geometry::getSurfaceNormal(int index) {
 	return m_surfaceNormals[index];
 }
 
+vec3 Geometry::getMinBounds() {
+	return m_minBounds;
+}
+
+vec3 Geometry::getMaxBounds() {
+	return m_maxBounds;
+}
+
 vec3 Geometry::getOrigin() {
 	vec3 average = vec3(0.0f, 0.0f, 0.0f);
 	for (int i = 0; i < m_points.size(); i++) {
@@ -400,3 +939,19 @@ vec3 Geometry::getOrigin() {
 	}
 	return average / m_points.size();
 }
+
+const vector<vec3>& Geometry::getPoints() {
+	return m_points;
+}
+
+const vector<vec2>& Geometry::getUvs() {
+	return m_uvs;
+}
+
+const vector<vec3>& Geometry::getNormals() {
+	return m_normals;
+}
+
+const vector<triangle>& Geometry::getTriangles() {
+	return m_triangles;
+}
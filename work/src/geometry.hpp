@@ -15,11 +15,13 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include "opengl.hpp"
+#include "triangle_bvh.hpp"
 
 struct vertex {
 	int p = 0; // index for point in m_points
@@ -31,6 +33,13 @@ struct triangle {
 	vertex v[3]; //requires 3 verticies
 };
 
+// Layout of each vertex in a mesh's vertex buffer
+struct meshVertex {
+	cgra::vec3 position;
+	cgra::vec3 normal;
+	cgra::vec2 uv;
+};
+
 struct material {
 	cgra::vec4 ambient;
 	cgra::vec4 diffuse;
@@ -50,15 +59,35 @@ class Geometry {
 				   bool);
 		~Geometry();
 
+		Geometry(const Geometry&) = delete;
+		Geometry& operator=(const Geometry&) = delete;
+
 		cgra::vec3 getPosition();
 		void setPosition(cgra::vec3);
 		void setMaterial(cgra::vec4, cgra::vec4, cgra::vec4, float, cgra::vec4);
 		cgra::vec3 rayIntersectsTriangle(cgra::vec3, cgra::vec3, int);
+		int raycastMesh(cgra::vec3, cgra::vec3, cgra::vec3&);
 		bool pointInsideMesh(cgra::vec3);
+		bool pointInsideMeshFast(cgra::vec3);
+		void buildOccupancyGrid(int resolution = 32);
+		bool hasOccupancyGrid();
+		float closestDistance(cgra::vec3);
+		uint64_t hash();
 		void renderGeometry(bool);
 		int triangleCount();
 		cgra::vec3 getSurfaceNormal(int);
 		cgra::vec3 getOrigin();
+		cgra::vec3 getMinBounds();
+		cgra::vec3 getMaxBounds();
+
+		// Raw mesh data as read from the file or given to the constructor
+		const std::vector<cgra::vec3>& getPoints();
+		const std::vector<cgra::vec2>& getUvs();
+		const std::vector<cgra::vec3>& getNormals();
+		const std::vector<triangle>& getTriangles();
+
+		// Prepare the vertex and index buffers ahead of the first draw
+		void buildVertexData();
 
 	private:
 		std::string m_filename;
@@ -71,20 +100,46 @@ class Geometry {
 		std::vector<cgra::vec3> m_surfaceNormals;
 
 		cgra::vec3 m_position = cgra::vec3(0.0f, 0.0f, 0.0f);
+		cgra::vec3 m_minBounds = cgra::vec3(0.0f, 0.0f, 0.0f);
+		cgra::vec3 m_maxBounds = cgra::vec3(0.0f, 0.0f, 0.0f);
 		material m_material;
 		float m_textureScale = 1.0f;
 
 		// The vector to return if no ray intersection is found
 		cgra::vec3 noIntersectionVector = cgra::vec3(std::numeric_limits<float>::max(), 0.0f, 0.0f);
 
-		// IDs for the display list to render
-		GLuint m_displayListPoly = 0;
-		GLuint m_displayListWire = 0;
+		// Acceleration structure for ray casts against the triangles
+		TriangleBVH m_bvh;
+
+		// Optional grid of cached winding numbers for fast inside / outside queries
+		std::vector<float> m_windingGrid;
+		int m_gridResolution = 0;
+		cgra::vec3 m_gridMin = cgra::vec3(0.0f, 0.0f, 0.0f);
+		cgra::vec3 m_gridCellSize = cgra::vec3(0.0f, 0.0f, 0.0f);
+
+		// Interleaved buffer of welded vertices, indexed by triangle corner and ordered for the vertex cache.
+		// The vertex array object is left at 0 on contexts without them
+		GLuint m_vertexArray = 0;
+		GLuint m_vertexBuffer = 0;
+		GLuint m_indexBuffer = 0;
+		GLenum m_indexType = GL_UNSIGNED_INT;
+		int m_indexCount = 0;
+
+		// Welded vertices and indices waiting to be uploaded on the first draw
+		std::vector<meshVertex> m_meshVertices;
+		std::vector<uint32_t> m_meshIndices;
 
 		void readOBJ(std::string);
+		bool readMeshCache(std::string);
+		void writeMeshCache(std::string);
 		void createNormals();
 		void createSurfaceNormals();
-		void createDisplayListPoly();
-		void createDisplayListWire();
-		void displayTriangles();
+		void computeBounds();
+		void buildBVH();
+		float windingNumber(cgra::vec3);
+		static bool vertexArraysSupported();
+		void setVertexPointers();
+		void createVertexBuffers();
+		void deleteVertexBuffers();
+		void drawTriangles();
 };
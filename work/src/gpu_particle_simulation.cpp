@@ -0,0 +1,203 @@
+//---------------------------------------------------------------------------
+// Transform Feedback Particle Simulation
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "gpu_particle_simulation.hpp"
+#include "opengl.hpp"
+#include "particle_renderer.hpp"
+#include "simple_shader.hpp"
+#include "soa_vector.hpp"
+
+using namespace std;
+using namespace cgra;
+
+static const string updateShaderPath = "./work/res/shaders/particleUpdate.vert";
+
+// Attribute locations of the update shader, position takes 0 so the draw is never skipped
+static const GLuint positionLocation = 0;
+static const GLuint velocityLocation = 1;
+static const GLuint accelerationLocation = 2;
+
+GLuint GpuParticleSimulation::updateProgram = 0;
+
+GpuParticleSimulation::~GpuParticleSimulation() {
+	release();
+}
+
+bool GpuParticleSimulation::supported() {
+	return GLEW_VERSION_3_0 && ParticleRenderer::instancingSupported();
+}
+
+// Build the shared update program with its outputs captured into separate buffers
+bool GpuParticleSimulation::buildProgram() {
+	static bool failed = false;
+	if (updateProgram) return true;
+	if (failed) return false;
+
+	try {
+		GLuint program = makeShaderProgramFromFile({ GL_VERTEX_SHADER }, { updateShaderPath });
+
+		// Varyings and attribute locations only take effect on the next link
+		const char *varyings[] = { "nextPosition", "nextVelocity" };
+		glTransformFeedbackVaryings(program, 2, varyings, GL_SEPARATE_ATTRIBS);
+		glBindAttribLocation(program, positionLocation, "position");
+		glBindAttribLocation(program, velocityLocation, "velocity");
+		glBindAttribLocation(program, accelerationLocation, "acceleration");
+		linkShaderProgram(program);
+
+		updateProgram = program;
+		return true;
+	} catch (const runtime_error &error) {
+		cerr << "GPU particle simulation unavailable: " << error.what() << endl;
+		failed = true;
+		return false;
+	}
+}
+
+bool GpuParticleSimulation::init(const vec3Array &positions, const vec3Array &velocities, const vec3Array &accelerations) {
+	release();
+
+	if (!supported() || !buildProgram()) return false;
+
+	particleCount = positions.size();
+	current = 0;
+
+	glGenBuffers(2, positionBuffers);
+	glGenBuffers(2, velocityBuffers);
+	glGenBuffers(1, &accelerationBuffer);
+
+	// Both sets of buffers are allocated up front, the second is filled by the first step
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_ARRAY_BUFFER, positionBuffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, particleCount * sizeof(vec3), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_ARRAY_BUFFER, velocityBuffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, particleCount * sizeof(vec3), nullptr, GL_DYNAMIC_COPY);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	uploadPositions(positions);
+	uploadVelocities(velocities);
+	uploadAccelerations(accelerations);
+
+	return true;
+}
+
+void GpuParticleSimulation::release() {
+	if (accelerationBuffer) {
+		glDeleteBuffers(2, positionBuffers);
+		glDeleteBuffers(2, velocityBuffers);
+		glDeleteBuffers(1, &accelerationBuffer);
+	}
+
+	positionBuffers[0] = positionBuffers[1] = 0;
+	velocityBuffers[0] = velocityBuffers[1] = 0;
+	accelerationBuffer = 0;
+	particleCount = 0;
+}
+
+bool GpuParticleSimulation::active() {
+	return accelerationBuffer != 0;
+}
+
+// Interleave the component arrays into the vec3 layout the shaders read
+void GpuParticleSimulation::upload(GLuint buffer, const vec3Array &values) {
+	vector<vec3> packed(particleCount);
+	for (int i = 0; i < particleCount; i++) {
+		packed[i] = values.get(i);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, particleCount * sizeof(vec3), packed.data(), GL_DYNAMIC_COPY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GpuParticleSimulation::uploadPositions(const vec3Array &positions) {
+	upload(positionBuffers[current], positions);
+}
+
+void GpuParticleSimulation::uploadVelocities(const vec3Array &velocities) {
+	upload(velocityBuffers[current], velocities);
+}
+
+void GpuParticleSimulation::uploadAccelerations(const vec3Array &accelerations) {
+	upload(accelerationBuffer, accelerations);
+}
+
+void GpuParticleSimulation::download(vec3Array &positions, vec3Array &velocities) {
+	vector<vec3> packed(particleCount);
+
+	glBindBuffer(GL_ARRAY_BUFFER, positionBuffers[current]);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, particleCount * sizeof(vec3), packed.data());
+	for (int i = 0; i < particleCount; i++) {
+		positions.set(i, packed[i]);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, velocityBuffers[current]);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, particleCount * sizeof(vec3), packed.data());
+	for (int i = 0; i < particleCount; i++) {
+		velocities.set(i, packed[i]);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Advance every particle one step, reading the current buffers and writing the others
+void GpuParticleSimulation::step(float maxVel, float radius, float damping) {
+	if (!active() || particleCount == 0) return;
+
+	int next = 1 - current;
+
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+	glUseProgram(updateProgram);
+	glUniform1f(glGetUniformLocation(updateProgram, "maxVel"), maxVel);
+	glUniform1f(glGetUniformLocation(updateProgram, "radius"), radius);
+	glUniform1f(glGetUniformLocation(updateProgram, "damping"), damping);
+
+	GLuint inputs[] = { positionBuffers[current], velocityBuffers[current], accelerationBuffer };
+	GLuint locations[] = { positionLocation, velocityLocation, accelerationLocation };
+	for (int i = 0; i < 3; i++) {
+		glBindBuffer(GL_ARRAY_BUFFER, inputs[i]);
+		glEnableVertexAttribArray(locations[i]);
+		glVertexAttribPointer(locations[i], 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*) 0);
+	}
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, positionBuffers[next]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, velocityBuffers[next]);
+
+	// Only the captured outputs are wanted, nothing is drawn
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, particleCount);
+	glEndTransformFeedback();
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, 0);
+
+	for (int i = 0; i < 3; i++) {
+		glDisableVertexAttribArray(locations[i]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glUseProgram(previousProgram);
+
+	current = next;
+}
+
+GLuint GpuParticleSimulation::getPositionBuffer() {
+	return positionBuffers[current];
+}
+
+int GpuParticleSimulation::getParticleCount() {
+	return particleCount;
+}
@@ -0,0 +1,59 @@
+//---------------------------------------------------------------------------
+// Transform Feedback Particle Simulation
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include "cgra_math.hpp"
+#include "opengl.hpp"
+#include "soa_vector.hpp"
+
+// Keeps particle positions, velocities and accelerations in GPU buffers and
+// advances them with the particleUpdate shader, ping ponging between two pairs
+// of position and velocity buffers. The CPU only touches per particle data
+// when it is uploaded by an animation trigger or read back at the end
+class GpuParticleSimulation {
+
+	public:
+		GpuParticleSimulation() {}
+		~GpuParticleSimulation();
+
+		GpuParticleSimulation(const GpuParticleSimulation&) = delete;
+		GpuParticleSimulation& operator=(const GpuParticleSimulation&) = delete;
+
+		// Returns true if the driver has everything the simulation and drawing from it need
+		static bool supported();
+
+		// Create the buffers from the given state, returns false if unsupported or the shader failed to build
+		bool init(const vec3Array&, const vec3Array&, const vec3Array&);
+		void release();
+		bool active();
+
+		// Replace part of the simulation state
+		void uploadPositions(const vec3Array&);
+		void uploadVelocities(const vec3Array&);
+		void uploadAccelerations(const vec3Array&);
+
+		// Read the current state back into the given arrays
+		void download(vec3Array&, vec3Array&);
+
+		void step(float, float, float);
+
+		// Buffer of tightly packed vec3 positions as of the last step
+		GLuint getPositionBuffer();
+		int getParticleCount();
+
+	private:
+		GLuint positionBuffers[2] = { 0, 0 };
+		GLuint velocityBuffers[2] = { 0, 0 };
+		GLuint accelerationBuffer = 0;
+		int current = 0;
+		int particleCount = 0;
+
+		static GLuint updateProgram;
+		static bool buildProgram();
+
+		void upload(GLuint, const vec3Array&);
+};
@@ -8,7 +8,9 @@
 
 #include <cmath>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <stdexcept>
 
@@ -19,9 +21,11 @@
 #include "simple_gui.hpp"
 #include "opengl.hpp"
 #include "geometry.hpp"
+#include "frustum.hpp"
 #include "tree.hpp"
 #include "fuzzy_object.hpp"
 #include "particle_system.hpp"
+#include "streaming_terrain.hpp"
 
 using namespace std;
 using namespace cgra;
@@ -48,10 +52,11 @@ float g_zoom = 1.0;
 
 // Shader fields
 GLuint g_shader = 0;
+GLuint g_impostorShader = 0;
 
 // Geometry draw lists
 Geometry* g_model = nullptr;
-Geometry* g_terrain = nullptr;
+StreamingTerrain* g_terrain = nullptr;
 
 // Tree to animate
 Tree* g_tree = nullptr;
@@ -83,6 +88,10 @@ bool treeMode = false;
 bool wireframeMode = false;
 bool realtimeBuild = false;
 bool exampleFuzzyObjectMode = false;
+bool bulkSeeding = false;
+particleRenderMode particleMode = particleRenderMode::spheres;
+bool gpuParticleAnimation = false;
+bool particleCollisions = false;
 bool partyMode = false;
 
 // Texture bindings
@@ -148,10 +157,13 @@ void keyCallback(GLFWwindow *win, int key, int scancode, int action, int mods) {
 		if (key == 'R' && action == 1) {
 			delete(g_tree);
 			g_tree = new Tree(tree_h, tree_t, tree_bL, tree_inf, tree_kill, tree_tW, tree_mW);
+			g_tree->setFuzzySeedingMode(bulkSeeding ? seedingMode::bulk : seedingMode::incremental);
+			g_tree->setFuzzyRenderMode(particleMode);
 
 			treeFuzzySystemFinishedBuilding = false;
 			realtimeBuild = false;
 			treeParticlesAnimating = false;
+			if (g_treeParticleSystem) g_treeParticleSystem->setPaused(true);
 		}
 		if (key == 'T' && action == 1) {
 			treeMode = !treeMode;
@@ -285,6 +297,9 @@ void keyCallback(GLFWwindow *win, int key, int scancode, int action, int mods) {
 				if (g_tree->finishedBuildingFuzzySystems()) {
 					delete(g_treeParticleSystem);
 					g_treeParticleSystem = new ParticleSystem(g_tree->getFuzzySystemPoints());
+					g_treeParticleSystem->setRenderMode(particleMode);
+					g_treeParticleSystem->setCollisions(particleCollisions);
+					if (!gpuParticleAnimation || !g_treeParticleSystem->startGpuSimulation()) g_treeParticleSystem->startSimulation();
 					treeFuzzySystemFinishedBuilding = true;
 
 					treeParticlesAnimating = true;
@@ -294,7 +309,11 @@ void keyCallback(GLFWwindow *win, int key, int scancode, int action, int mods) {
 
 				// Check if the example fuzzy system finished building
 				if (g_fuzzy_system->finishedBuilding()) {
+					delete(g_particle_system);
 					g_particle_system = new ParticleSystem(g_fuzzy_system->getSystem());
+					g_particle_system->setRenderMode(particleMode);
+					g_particle_system->setCollisions(particleCollisions);
+					if (!gpuParticleAnimation || !g_particle_system->startGpuSimulation()) g_particle_system->startSimulation();
 					exampleSystemFinishedBuilding = true;
 					exampleParticlesAnimating = true;
 					g_particle_system->explode();
@@ -305,7 +324,10 @@ void keyCallback(GLFWwindow *win, int key, int scancode, int action, int mods) {
 		// 'r' key pressed
 		if (key == 'R' && (action == 1)) {
 			treeParticlesAnimating = false;
-			if (treeFuzzySystemFinishedBuilding) g_treeParticleSystem->resetParticles();
+			if (treeFuzzySystemFinishedBuilding) {
+				g_treeParticleSystem->setPaused(true);
+				g_treeParticleSystem->resetParticles();
+			}
 		}
 
 		// 'q' key pressed
@@ -317,6 +339,44 @@ void keyCallback(GLFWwindow *win, int key, int scancode, int action, int mods) {
 		if (key == 'E' && action == 1) {
 			exampleFuzzyObjectMode = !exampleFuzzyObjectMode;
 		}
+
+		// 'l' key pressed
+		if (key == 'L' && action == 1) {
+			bulkSeeding = !bulkSeeding;
+
+			// Systems that have already started building keep the mode they started with
+			seedingMode mode = bulkSeeding ? seedingMode::bulk : seedingMode::incremental;
+			g_fuzzy_system->setSeedingMode(mode);
+			g_tree->setFuzzySeedingMode(mode);
+		}
+
+		// 'i' key pressed
+		if (key == 'I' && action == 1) {
+			// Cycle between sphere meshes, sphere impostors and point sprites
+			if (particleMode == particleRenderMode::spheres) particleMode = particleRenderMode::impostors;
+			else if (particleMode == particleRenderMode::impostors) particleMode = particleRenderMode::pointSprites;
+			else particleMode = particleRenderMode::spheres;
+
+			g_fuzzy_system->setRenderMode(particleMode);
+			g_tree->setFuzzyRenderMode(particleMode);
+			if (g_particle_system) g_particle_system->setRenderMode(particleMode);
+			if (g_treeParticleSystem) g_treeParticleSystem->setRenderMode(particleMode);
+		}
+
+		// 'u' key pressed
+		if (key == 'U' && action == 1) {
+			// Only takes effect for particle systems created after this
+			gpuParticleAnimation = !gpuParticleAnimation;
+		}
+
+		// 'o' key pressed
+		if (key == 'O' && action == 1) {
+			// Collisions are not simulated on the GPU, systems animating there ignore them
+			particleCollisions = !particleCollisions;
+
+			if (g_particle_system) g_particle_system->setCollisions(particleCollisions);
+			if (g_treeParticleSystem) g_treeParticleSystem->setCollisions(particleCollisions);
+		}
 	}
 }
 
@@ -330,7 +390,7 @@ void initGeometry() {
 	g_model = new Geometry("./work/res/assets/bunny-reduced.obj");
 	g_model->setPosition(vec3(0, 1.2f, 0));
 
-	g_terrain = new Geometry("./work/res/assets/plane.obj", 30.0f);
+	g_terrain = new StreamingTerrain("./work/res/assets/plane.obj", 30.0f);
 
 	g_tree = new Tree();
 	g_tree->setPosition(vec3(0, 0, 0));
@@ -437,6 +497,19 @@ void initLight() {
 // Load a shader from a given location
 void initShader(string vertPath, string fragPath) {
 	g_shader = makeShaderProgramFromFile({GL_VERTEX_SHADER, GL_FRAGMENT_SHADER }, { vertPath, fragPath });
+
+	// The same shader with the impostor depth writes compiled in, used only to draw impostors
+	ifstream vertFile(vertPath), fragFile(fragPath);
+	stringstream vertSource, fragSource;
+	vertSource << vertFile.rdbuf();
+	fragSource << fragFile.rdbuf();
+
+	// Defines have to come after the version line
+	string frag = fragSource.str();
+	frag.insert(frag.find('\n') + 1, "#define IMPOSTORS\n");
+
+	g_impostorShader = makeShaderProgram({GL_VERTEX_SHADER, GL_FRAGMENT_SHADER }, { vertSource.str(), frag });
+	ParticleRenderer::setImpostorProgram(g_impostorShader);
 }
 
 // Sets up where the camera is in the scene
@@ -601,20 +674,18 @@ void update() {
 		// Update example system building
 		if (!g_fuzzy_system->finishedBuilding() && realtimeBuild) {
 			g_fuzzy_system->buildSystemIncrement();
-		} else if (exampleParticlesAnimating) {
-			g_particle_system->update();
+
+			if (g_fuzzy_system->finishedBuilding()) {
+				cout << "Example fuzzy system built in " << g_fuzzy_system->getBuildSteps() << " steps" << endl;
+			}
 		}
 	} else {
 
-		// Tree system animation / building
+		// Update tree particle system building, animation runs on the particle system's own thread
 		if (!treeFuzzySystemFinishedBuilding) {
-
-			// Update tree particle system building
 			if (!g_tree->finishedBuildingFuzzySystems() && realtimeBuild) {
 				g_tree->buildFuzzySystems(true);
 			}
-		} else if (treeParticlesAnimating) {
-			g_treeParticleSystem->update();
 		}
 	}
 }
@@ -636,7 +707,7 @@ void renderScene() {
 
 		glBindTexture(GL_TEXTURE_2D, t_grass);
 		glUniform1i(glGetUniformLocation(g_shader, "useTexture"), true);
-		g_terrain->renderGeometry(false);
+		g_terrain->renderTerrain(false);
 		glUniform1i(glGetUniformLocation(g_shader, "useTexture"), false);
 
 		glPopMatrix();
@@ -650,12 +721,20 @@ void renderScene() {
 
 	} else if (exampleFuzzyObjectMode) {
 
+		// Skip the example model and fuzzy system when their bounds are out of view, the
+		// particles stay inside the model so only need to be padded by their radius
+		Frustum frustum = Frustum::fromCurrentMatrices();
+		vec3 position = g_model->getPosition();
+		vec3 minBounds = g_model->getMinBounds() + position;
+		vec3 maxBounds = g_model->getMaxBounds() + position;
+		vec3 margin = vec3(1.0f, 1.0f, 1.0f) * g_fuzzy_system->getParticleRadius();
+
 		// Render example model and fuzzy system
-		if (!g_fuzzy_system->finishedBuilding()) {
+		if (!g_fuzzy_system->finishedBuilding() && frustum.intersectsBox(minBounds, maxBounds)) {
 			g_model->renderGeometry(wireframeMode);
 		}
 
-		if (!exampleParticlesAnimating) {
+		if (!exampleParticlesAnimating && frustum.intersectsBox(minBounds - margin, maxBounds + margin)) {
 			g_fuzzy_system->renderSystem();
 		}
 
@@ -821,8 +900,9 @@ int main(int argc, char **argv) {
 	//t_leaves = initTexture("./work/res/textures/leaves.tga");
 
 	// Initialize example fuzzy system
-	g_fuzzy_system = new FuzzyObject(g_model);
+	g_fuzzy_system = new FuzzyObject(g_model, true);
 	g_fuzzy_system->setExampleSystemAttributes();
+	g_fuzzy_system->loadCachedSystem();
 
 	// Initialize the skybox textures
 	for (int i = 0; i < 6; i++) {
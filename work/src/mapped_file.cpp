@@ -0,0 +1,96 @@
+//---------------------------------------------------------------------------
+// Read Only Memory Mapped File
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.hpp"
+
+using namespace std;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string &filename) {
+	m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		m_file = nullptr;
+		throw runtime_error("Error :: could not open file.");
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(m_file, &size);
+	m_size = size_t(size.QuadPart);
+
+	// Empty files cannot be mapped, there is nothing to read from them anyway
+	if (m_size == 0) return;
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping) m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data) {
+		if (m_mapping) CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		throw runtime_error("Error :: could not map file.");
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file) CloseHandle(m_file);
+}
+
+#else
+
+MappedFile::MappedFile(const string &filename) {
+	m_descriptor = open(filename.c_str(), O_RDONLY);
+	if (m_descriptor < 0) throw runtime_error("Error :: could not open file.");
+
+	struct stat info;
+	if (fstat(m_descriptor, &info) != 0) {
+		close(m_descriptor);
+		throw runtime_error("Error :: could not open file.");
+	}
+	m_size = size_t(info.st_size);
+
+	// Empty files cannot be mapped, there is nothing to read from them anyway
+	if (m_size == 0) return;
+
+	void *mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_descriptor, 0);
+	if (mapping == MAP_FAILED) {
+		close(m_descriptor);
+		throw runtime_error("Error :: could not map file.");
+	}
+
+	// The file is read front to back, so let the OS read ahead aggressively
+	madvise(mapping, m_size, MADV_SEQUENTIAL);
+	m_data = static_cast<const char*>(mapping);
+}
+
+MappedFile::~MappedFile() {
+	if (m_data) munmap(const_cast<char*>(m_data), m_size);
+	if (m_descriptor >= 0) close(m_descriptor);
+}
+
+#endif
+
+const char* MappedFile::data() const {
+	return m_data;
+}
+
+size_t MappedFile::size() const {
+	return m_size;
+}
@@ -0,0 +1,37 @@
+//---------------------------------------------------------------------------
+// Read Only Memory Mapped File
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Maps the whole of a file into memory so it can be parsed in place without
+// copying it into buffers first. Pages are read in by the OS as they are touched
+class MappedFile {
+
+	public:
+		// Throws a runtime_error if the file cannot be opened or mapped
+		MappedFile(const std::string&);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const char* data() const;
+		std::size_t size() const;
+
+	private:
+		const char *m_data = nullptr;
+		std::size_t m_size = 0;
+
+#ifdef _WIN32
+		void *m_file = nullptr;
+		void *m_mapping = nullptr;
+#else
+		int m_descriptor = -1;
+#endif
+};
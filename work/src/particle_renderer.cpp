@@ -0,0 +1,356 @@
+//---------------------------------------------------------------------------
+// Instanced Particle Renderer
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <cmath>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "cgra_geometry.hpp"
+#include "opengl.hpp"
+#include "particle_renderer.hpp"
+#include "soa_vector.hpp"
+
+using namespace std;
+using namespace cgra;
+
+// Resolution of the particle sphere, matching the old per particle display lists
+static const int sphereSlices = 6;
+static const int sphereStacks = 6;
+
+// Values of the particleMode uniform in phongShader
+static const int shaderModeNone = 0;
+static const int shaderModeSpheres = 1;
+static const int shaderModePointSprites = 2;
+static const int shaderModeImpostors = 3;
+
+GLuint ParticleRenderer::impostorProgram = 0;
+GLuint ParticleRenderer::sphereBuffer = 0;
+int ParticleRenderer::sphereVertexCount = 0;
+GLuint ParticleRenderer::displayList = 0;
+int ParticleRenderer::rendererCount = 0;
+
+bool ParticleRenderer::instancingSupported() {
+	return GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced);
+}
+
+static void vertexAttribDivisor(GLuint index, GLuint divisor) {
+	if (GLEW_VERSION_3_3) glVertexAttribDivisor(index, divisor);
+	else glVertexAttribDivisorARB(index, divisor);
+}
+
+static void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+	if (GLEW_VERSION_3_3) glDrawArraysInstanced(mode, first, count, instances);
+	else glDrawArraysInstancedARB(mode, first, count, instances);
+}
+
+ParticleRenderer::ParticleRenderer() {
+	if (rendererCount++ == 0) setupSphere();
+}
+
+ParticleRenderer::~ParticleRenderer() {
+	if (instanceBuffer) glDeleteBuffers(1, &instanceBuffer);
+
+	// The sphere is shared, so only the last renderer deletes it
+	if (--rendererCount == 0) {
+		glDeleteBuffers(1, &sphereBuffer);
+		glDeleteLists(displayList, 1);
+		sphereBuffer = 0;
+		displayList = 0;
+	}
+}
+
+// The sphere is a unit sphere scaled when drawn, so changing the radius is free
+void ParticleRenderer::setRadius(float r) {
+	radius = r;
+}
+
+void ParticleRenderer::setRenderMode(particleRenderMode m) {
+	mode = m;
+}
+
+particleRenderMode ParticleRenderer::getRenderMode() {
+	return mode;
+}
+
+void ParticleRenderer::setImpostorProgram(GLuint program) {
+	impostorProgram = program;
+}
+
+// The program the particles are drawn with when the given one is bound
+GLint ParticleRenderer::drawProgram(GLint program) {
+	return mode == particleRenderMode::impostors && impostorProgram ? impostorProgram : program;
+}
+
+// Build the unit sphere geometry shared by every renderer, the same triangles cgraSphere draws as strips
+void ParticleRenderer::setupSphere() {
+	displayList = glGenLists(1);
+	glNewList(displayList, GL_COMPILE);
+	cgraSphere(1.0f, sphereSlices, sphereStacks);
+	glEndList();
+
+	int dualSlices = sphereSlices * 2;
+
+	vector<vec3> directions;
+	for (int stack = 0; stack <= sphereStacks; stack++) {
+		float theta = math::pi() * float(stack) / sphereStacks;
+
+		for (int slice = 0; slice <= dualSlices; slice++) {
+			float phi = 2 * math::pi() * float(slice) / dualSlices;
+			directions.push_back(vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta)));
+		}
+	}
+
+	// Interleaved position and normal of each vertex
+	vector<float> vertices;
+	auto addVertex = [&](vec3 position, vec3 normal) {
+		vertices.push_back(position.x);
+		vertices.push_back(position.y);
+		vertices.push_back(position.z);
+		vertices.push_back(normal.x);
+		vertices.push_back(normal.y);
+		vertices.push_back(normal.z);
+	};
+
+	for (int stack = 0; stack < sphereStacks; stack++) {
+		for (int slice = 0; slice < dualSlices; slice++) {
+			vec3 h0 = directions[slice + stack * (dualSlices + 1)];
+			vec3 h1 = directions[slice + 1 + stack * (dualSlices + 1)];
+			vec3 l0 = directions[slice + (stack + 1) * (dualSlices + 1)];
+			vec3 l1 = directions[slice + 1 + (stack + 1) * (dualSlices + 1)];
+
+			// Two triangles per quad, wound the same way as the strip
+			addVertex(h0, h0);
+			addVertex(l0, l0);
+			addVertex(h1, h1);
+			addVertex(h1, h1);
+			addVertex(l0, l0);
+			addVertex(l1, l1);
+		}
+	}
+
+	sphereVertexCount = vertices.size() / 6;
+
+	// Point sprites are offset from the origin like the sphere vertices
+	addVertex(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f));
+
+	// Impostor quad corners as a triangle strip, expanded to face the eye in the shader
+	addVertex(vec3(-1.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f));
+	addVertex(vec3(1.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f));
+	addVertex(vec3(-1.0f, 1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f));
+	addVertex(vec3(1.0f, 1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f));
+
+	glGenBuffers(1, &sphereBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, sphereBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ParticleRenderer::render(const vec3Array &positions, const vector<vec3> &colours) {
+	renderParticles(positions, &colours, vec4(1.0f, 1.0f, 1.0f, 1.0f));
+}
+
+void ParticleRenderer::render(const vec3Array &positions, vec4 colour) {
+	renderParticles(positions, nullptr, colour);
+}
+
+// Find the instance attributes of the bound shader, returns false if instancing cannot be used
+bool ParticleRenderer::findAttributes(GLint &program, GLint locations[4]) {
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	if (!program || !instancingSupported()) return false;
+
+	GLint shader = drawProgram(program);
+	locations[0] = glGetAttribLocation(shader, "instanceX");
+	locations[1] = glGetAttribLocation(shader, "instanceY");
+	locations[2] = glGetAttribLocation(shader, "instanceZ");
+	locations[3] = glGetAttribLocation(shader, "instanceColour");
+
+	return locations[0] >= 0 && locations[1] >= 0 && locations[2] >= 0 && locations[3] >= 0;
+}
+
+void ParticleRenderer::renderParticles(const vec3Array &positions, const vector<vec3> *colours, vec4 colour) {
+	int count = positions.size();
+	if (count == 0) return;
+
+	GLint program = 0;
+	GLint locations[4];
+	if (!findAttributes(program, locations)) {
+		renderLegacy(positions, colours, colour);
+		return;
+	}
+
+	// Stream this frame's data as separate x, y, z and colour blocks so the
+	// component arrays are copied straight across
+	size_t componentBytes = count * sizeof(float);
+	size_t colourBytes = colours ? count * sizeof(vec3) : 0;
+	size_t totalBytes = componentBytes * 3 + colourBytes;
+
+	if (!instanceBuffer) glGenBuffers(1, &instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+	// Orphan the previous storage so the upload does not wait on last frame's draw
+	instanceBufferSize = max(instanceBufferSize, totalBytes);
+	glBufferData(GL_ARRAY_BUFFER, instanceBufferSize, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, componentBytes, positions.x.data());
+	glBufferSubData(GL_ARRAY_BUFFER, componentBytes, componentBytes, positions.y.data());
+	glBufferSubData(GL_ARRAY_BUFFER, componentBytes * 2, componentBytes, positions.z.data());
+	if (colours) glBufferSubData(GL_ARRAY_BUFFER, componentBytes * 3, colourBytes, colours->data());
+
+	particleInstanceLayout layout;
+	layout.buffer = instanceBuffer;
+	layout.positionStride = 0;
+	for (int i = 0; i < 3; i++) {
+		layout.positionOffsets[i] = componentBytes * i;
+	}
+	layout.perParticleColour = colours != nullptr;
+	layout.colourOffset = componentBytes * 3;
+
+	drawInstances(program, locations, layout, count, colour);
+}
+
+void ParticleRenderer::render(GLuint positionBuffer, int count, vec4 colour) {
+	if (count == 0) return;
+
+	GLint program = 0;
+	GLint locations[4];
+	if (!findAttributes(program, locations)) {
+
+		// Read the positions back for the per particle fallback
+		vector<vec3> packed(count);
+		glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(vec3), packed.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		vec3Array positions;
+		positions.reserve(count);
+		for (vec3 p : packed) {
+			positions.push_back(p);
+		}
+
+		renderLegacy(positions, nullptr, colour);
+		return;
+	}
+
+	// Packed vec3 positions, read component by component with a stride
+	particleInstanceLayout layout;
+	layout.buffer = positionBuffer;
+	layout.positionStride = sizeof(vec3);
+	for (int i = 0; i < 3; i++) {
+		layout.positionOffsets[i] = sizeof(float) * i;
+	}
+	layout.perParticleColour = false;
+	layout.colourOffset = 0;
+
+	drawInstances(program, locations, layout, count, colour);
+}
+
+void ParticleRenderer::drawInstances(GLint boundProgram, const GLint locations[4], const particleInstanceLayout &layout, int count, vec4 colour) {
+
+	// Switch to the impostor program for impostors, carrying over the bound program's switches
+	GLint program = drawProgram(boundProgram);
+	if (program != boundProgram) {
+		glUseProgram(program);
+		for (const char *name : { "texture0", "useTexture", "useLighting" }) {
+			GLint value = 0;
+			glGetUniformiv(boundProgram, glGetUniformLocation(boundProgram, name), &value);
+			glUniform1i(glGetUniformLocation(program, name), value);
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, layout.buffer);
+
+	for (int i = 0; i < 3; i++) {
+		glEnableVertexAttribArray(locations[i]);
+		glVertexAttribPointer(locations[i], 1, GL_FLOAT, GL_FALSE, layout.positionStride, (const GLvoid*) layout.positionOffsets[i]);
+		vertexAttribDivisor(locations[i], 1);
+	}
+
+	GLint colourLocation = locations[3];
+	if (layout.perParticleColour) {
+		glEnableVertexAttribArray(colourLocation);
+		glVertexAttribPointer(colourLocation, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*) layout.colourOffset);
+		vertexAttribDivisor(colourLocation, 1);
+	} else {
+		glVertexAttrib4fv(colourLocation, colour.dataPointer());
+	}
+
+	// Shared sphere vertices
+	glBindBuffer(GL_ARRAY_BUFFER, sphereBuffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), (const GLvoid*) 0);
+	glNormalPointer(GL_FLOAT, 6 * sizeof(float), (const GLvoid*) (3 * sizeof(float)));
+
+	glUniform1f(glGetUniformLocation(program, "particleRadius"), radius);
+
+	if (mode == particleRenderMode::pointSprites) {
+
+		// Points are sized so they cover the sphere they stand in for
+		GLfloat projection[16];
+		GLint viewport[4];
+		glGetFloatv(GL_PROJECTION_MATRIX, projection);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		glUniform1i(glGetUniformLocation(program, "particleMode"), shaderModePointSprites);
+		glUniform1f(glGetUniformLocation(program, "pointScale"), projection[5] * viewport[3]);
+
+		glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+		glEnable(GL_POINT_SPRITE);
+		drawArraysInstanced(GL_POINTS, sphereVertexCount, 1, count);
+		glDisable(GL_POINT_SPRITE);
+		glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+	} else if (mode == particleRenderMode::impostors && impostorProgram) {
+
+		// One quad per particle, the fragment shader finds the sphere surface and its depth
+		glUniform1i(glGetUniformLocation(program, "particleMode"), shaderModeImpostors);
+		drawArraysInstanced(GL_TRIANGLE_STRIP, sphereVertexCount + 1, 4, count);
+	} else {
+		glUniform1i(glGetUniformLocation(program, "particleMode"), shaderModeSpheres);
+		drawArraysInstanced(GL_TRIANGLES, 0, sphereVertexCount, count);
+	}
+
+	glUniform1i(glGetUniformLocation(program, "particleMode"), shaderModeNone);
+	if (program != boundProgram) glUseProgram(boundProgram);
+
+	// Restore state so later draws are not instanced
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+
+	for (int i = 0; i < 3; i++) {
+		vertexAttribDivisor(locations[i], 0);
+		glDisableVertexAttribArray(locations[i]);
+	}
+
+	if (layout.perParticleColour) {
+		vertexAttribDivisor(colourLocation, 0);
+		glDisableVertexAttribArray(colourLocation);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// One display list call per particle, used when instancing is unavailable
+void ParticleRenderer::renderLegacy(const vec3Array &positions, const vector<vec3> *colours, vec4 colour) {
+
+	// The unit sphere is scaled to the radius, which would scale its normals with it
+	glPushAttrib(GL_ENABLE_BIT);
+	glEnable(GL_RESCALE_NORMAL);
+
+	for (size_t i = 0; i < positions.size(); i++) {
+		glPushMatrix();
+		glTranslatef(positions.x[i], positions.y[i], positions.z[i]);
+		glScalef(radius, radius, radius);
+
+		if (colours) colour = vec4((*colours)[i], 1.0f);
+		glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, colour.dataPointer());
+
+		// Draw the particle
+		glCallList(displayList);
+
+		glPopMatrix();
+	}
+
+	glPopAttrib();
+}
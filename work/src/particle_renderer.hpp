@@ -0,0 +1,91 @@
+//---------------------------------------------------------------------------
+// Instanced Particle Renderer
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "opengl.hpp"
+#include "soa_vector.hpp"
+
+enum class particleRenderMode {
+	spheres,      // Instanced low poly sphere meshes
+	impostors,    // Ray cast spheres on camera facing quads, for dense clouds
+	pointSprites  // One screen aligned point per particle, for very large counts
+};
+
+// Where the per particle attributes are read from when drawing
+struct particleInstanceLayout {
+	GLuint buffer;
+	GLsizei positionStride; // 0 if each component is tightly packed
+	std::size_t positionOffsets[3];
+	bool perParticleColour;
+	std::size_t colourOffset;
+};
+
+// Draws every particle of a system with a single instanced draw call. Positions
+// and colours are streamed into a buffer once per frame and offset a unit sphere
+// mesh, shared by every renderer and scaled to the radius in the vertex shader.
+// Falls back to one display list call per particle when instancing is not
+// supported by the driver or bound shader.
+class ParticleRenderer {
+
+	public:
+		ParticleRenderer();
+		~ParticleRenderer();
+
+		// Owns GL objects so cannot be copied
+		ParticleRenderer(const ParticleRenderer&) = delete;
+		ParticleRenderer& operator=(const ParticleRenderer&) = delete;
+
+		void setRadius(float);
+		void setRenderMode(particleRenderMode);
+		particleRenderMode getRenderMode();
+
+		// Draw particles with a colour each, or all in the same colour
+		void render(const vec3Array&, const std::vector<cgra::vec3>&);
+		void render(const vec3Array&, cgra::vec4);
+
+		// Draw particles whose packed vec3 positions are already in a GPU buffer
+		void render(GLuint, int, cgra::vec4);
+
+		static bool instancingSupported();
+
+		// Variant of the bound shader that writes the depth of impostor spheres. Writing depth
+		// turns off early depth tests, so the main shader leaves it out and impostors are drawn
+		// with this instead. Without one impostors are drawn as sphere meshes
+		static void setImpostorProgram(GLuint);
+
+	private:
+		particleRenderMode mode = particleRenderMode::spheres;
+		float radius = 0.2f;
+
+		// Unit sphere mesh as interleaved positions and normals, followed by a single
+		// vertex at the origin used as the point sprite and the 4 impostor quad corners
+		static GLuint sphereBuffer;
+		static int sphereVertexCount;
+
+		// Per particle data streamed each frame
+		GLuint instanceBuffer = 0;
+		std::size_t instanceBufferSize = 0;
+
+		// Unit sphere for the non instanced fallback
+		static GLuint displayList;
+
+		// Renderers sharing the sphere, which is deleted along with the last of them
+		static int rendererCount;
+
+		static GLuint impostorProgram;
+
+		static void setupSphere();
+		GLint drawProgram(GLint);
+		bool findAttributes(GLint&, GLint[4]);
+		void renderParticles(const vec3Array&, const std::vector<cgra::vec3>*, cgra::vec4);
+		void drawInstances(GLint, const GLint[4], const particleInstanceLayout&, int, cgra::vec4);
+		void renderLegacy(const vec3Array&, const std::vector<cgra::vec3>*, cgra::vec4);
+};
@@ -4,54 +4,325 @@
 // By Jack Purvis
 //---------------------------------------------------------------------------
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "cgra_math.hpp"
 #include "cgra_geometry.hpp"
+#include "frustum.hpp"
 #include "opengl.hpp"
 #include "particle_system.hpp"
+#include "thread_pool.hpp"
 
 using namespace std;
 using namespace cgra;
 
 ParticleSystem::ParticleSystem(vector<vec3> points) {
 	// Create a particle system out of the given points
+	originalPos.reserve(points.size());
 	for (int i = 0; i < points.size(); i++) {
-		particle p;
-		p.original_pos = vec3(points[i]);
-		p.pos = points[i];
-		p.vel = vec3(0.0f, 0.0f, 0.0f);
-		p.acc = vec3(0.0f, 0.0f, 0.0f);
-		p.col = vec3(1.0f, 1.0f, 1.0f);
-		particles.push_back(p);
+		originalPos.push_back(points[i]);
 	}
 
-	setupDisplayList();
+	particlePos = originalPos;
+	particleVel.resize(points.size());
+	particleAcc.resize(points.size());
+	stillSteps.assign(points.size(), 0);
+	awakeCount = points.size();
+
+	renderer.setRadius(p_radius);
 }
 
-ParticleSystem::~ParticleSystem() {}
+ParticleSystem::~ParticleSystem() {
+	stopSimulation();
+}
 
-void ParticleSystem::update() {
-	// For each particle
-	for (int i = 0; i < particles.size(); i++) {
+// Integrate particles [begin, end) one at a time. Written without branches so
+// the compiler is free to vectorise it, and used for the remainder of the AVX kernel
+static void integrateParticlesScalar(int begin, int end, float *posX, float *posY, float *posZ,
+	float *velX, float *velY, float *velZ, const float *accX, const float *accY, const float *accZ,
+	float maxVel, float radius, float damping) {
+	for (int i = begin; i < end; i++) {
 
 		// Update the particle velocity and position
-		particles[i].vel = clamp(particles[i].vel + particles[i].acc, -p_maxVel, p_maxVel);
-		particles[i].pos += particles[i].vel;
-
-		// Perform simple bouncing off of the floor plane
-		vec3 actualPos = particles[i].pos;
-		if (actualPos.y - p_radius < 0.0f) {
-			particles[i].vel.y *= -1;
-			particles[i].vel *= 0.9f;
-			particles[i].pos.y += p_radius;
+		float vx = std::min(std::max(velX[i] + accX[i], -maxVel), maxVel);
+		float vy = std::min(std::max(velY[i] + accY[i], -maxVel), maxVel);
+		float vz = std::min(std::max(velZ[i] + accZ[i], -maxVel), maxVel);
+		float py = posY[i] + vy;
+		posX[i] += vx;
+		posZ[i] += vz;
+
+		// Bounce off of the floor plane, reflecting and damping the velocity and
+		// placing the particle back on the floor so that it can come to rest
+		bool below = py - radius < 0.0f;
+		float scale = below ? damping : 1.0f;
+		velX[i] = vx * scale;
+		velY[i] = vy * (below ? -damping : 1.0f);
+		velZ[i] = vz * scale;
+		posY[i] = std::max(py, radius);
+	}
+}
+
+#ifdef __AVX2__
+// Integrate particles [begin, end) eight at a time, the floor bounce is applied with blends
+// begin must be a multiple of 8 so the loads stay aligned
+static void integrateParticles(int begin, int end, float *posX, float *posY, float *posZ,
+	float *velX, float *velY, float *velZ, const float *accX, const float *accY, const float *accZ,
+	float maxVel, float radius, float damping) {
+	const __m256 maxV = _mm256_set1_ps(maxVel);
+	const __m256 minV = _mm256_set1_ps(-maxVel);
+	const __m256 r = _mm256_set1_ps(radius);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 damp = _mm256_set1_ps(damping);
+	const __m256 reflect = _mm256_set1_ps(-damping);
+
+	int i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256 vx = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_load_ps(velX + i), _mm256_load_ps(accX + i)), minV), maxV);
+		__m256 vy = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_load_ps(velY + i), _mm256_load_ps(accY + i)), minV), maxV);
+		__m256 vz = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_load_ps(velZ + i), _mm256_load_ps(accZ + i)), minV), maxV);
+		__m256 py = _mm256_add_ps(_mm256_load_ps(posY + i), vy);
+		_mm256_store_ps(posX + i, _mm256_add_ps(_mm256_load_ps(posX + i), vx));
+		_mm256_store_ps(posZ + i, _mm256_add_ps(_mm256_load_ps(posZ + i), vz));
+
+		__m256 below = _mm256_cmp_ps(_mm256_sub_ps(py, r), zero, _CMP_LT_OQ);
+		__m256 scale = _mm256_blendv_ps(one, damp, below);
+		_mm256_store_ps(velX + i, _mm256_mul_ps(vx, scale));
+		_mm256_store_ps(velY + i, _mm256_mul_ps(vy, _mm256_blendv_ps(one, reflect, below)));
+		_mm256_store_ps(velZ + i, _mm256_mul_ps(vz, scale));
+		_mm256_store_ps(posY + i, _mm256_max_ps(py, r));
+	}
+
+	integrateParticlesScalar(i, end, posX, posY, posZ, velX, velY, velZ, accX, accY, accZ, maxVel, radius, damping);
+}
+#endif
+
+// Move particles [begin, end) by their collision corrections. Particles pushed into the
+// floor plane are left resting on it rather than bounced, so piles can settle
+static void applyCollisionCorrections(int begin, int end, float *posX, float *posY, float *posZ,
+	float *velX, float *velY, float *velZ, const float *dpX, const float *dpY, const float *dpZ,
+	const float *dvX, const float *dvY, const float *dvZ, float radius) {
+	for (int i = begin; i < end; i++) {
+		float py = posY[i] + dpY[i];
+		float vy = velY[i] + dvY[i];
+		posX[i] += dpX[i];
+		posZ[i] += dpZ[i];
+		velX[i] += dvX[i];
+		velZ[i] += dvZ[i];
+
+		bool below = py < radius;
+		posY[i] = std::max(py, radius);
+		velY[i] = below ? std::max(vy, 0.0f) : vy;
+	}
+}
+
+// Index of the hash table bucket for a grid cell, the table size must be a power of two.
+// Cells next to each other along x get consecutive buckets, so the three cells of a
+// neighbouring row can be scanned as one range of the table
+static inline int hashCell(int x, int y, int z, int mask) {
+	return int(unsigned(x) + ((unsigned(y) * 73856093u) ^ (unsigned(z) * 19349663u))) & mask;
+}
+
+void ParticleSystem::update() {
+
+	// Update the awake particle velocities and positions, and bounce them off of the floor plane
+	ThreadPool::shared().parallelFor(awakeCount, particleChunkSize, [this](int begin, int end, int) {
+#ifdef __AVX2__
+		integrateParticles(begin, end, particlePos.x.data(), particlePos.y.data(), particlePos.z.data(),
+			particleVel.x.data(), particleVel.y.data(), particleVel.z.data(),
+			particleAcc.x.data(), particleAcc.y.data(), particleAcc.z.data(), p_maxVel, p_radius, p_floorDamping);
+#else
+		integrateParticlesScalar(begin, end, particlePos.x.data(), particlePos.y.data(), particlePos.z.data(),
+			particleVel.x.data(), particleVel.y.data(), particleVel.z.data(),
+			particleAcc.x.data(), particleAcc.y.data(), particleAcc.z.data(), p_maxVel, p_radius, p_floorDamping);
+#endif
+	});
+
+	if (collisions && awakeCount > 0) resolveCollisions();
+
+	updateSleeping();
+	updateColour();
+}
+
+// Count how long each awake particle has been nearly still, and move the ones that have
+// been still for long enough behind the awake particles so later steps skip them
+void ParticleSystem::updateSleeping() {
+	float sleepSpeedSquared = p_sleepSpeed * p_sleepSpeed;
+
+	ThreadPool::shared().parallelFor(awakeCount, particleChunkSize, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			float speedSquared = particleVel.x[i] * particleVel.x[i] + particleVel.y[i] * particleVel.y[i] + particleVel.z[i] * particleVel.z[i];
+			stillSteps[i] = speedSquared < sleepSpeedSquared ? stillSteps[i] + 1 : 0;
+		}
+	});
+
+	for (int i = 0; i < awakeCount;) {
+		if (stillSteps[i] >= sleepSteps) {
+			particleVel.set(i, vec3(0.0f, 0.0f, 0.0f));
+			swapParticles(i, --awakeCount);
+		} else {
+			i++;
+		}
+	}
+}
+
+void ParticleSystem::wakeAll() {
+	awakeCount = particlePos.size();
+	fill(stillSteps.begin(), stillSteps.end(), 0);
+}
+
+// Exchange every attribute of two particles, the order of particles is otherwise meaningless
+void ParticleSystem::swapParticles(int a, int b) {
+	if (a == b) return;
+
+	originalPos.swap(a, b);
+	particlePos.swap(a, b);
+	particleVel.swap(a, b);
+	particleAcc.swap(a, b);
+	std::swap(stillSteps[a], stillSteps[b]);
+}
+
+// Returns true if stepping would change nothing, every particle is asleep and the colour has finished fading
+bool ParticleSystem::settled() {
+	return awakeCount == 0 && animationStep == animationLength;
+}
+
+// Bucket every particle by the hashed grid cell it is in. A counting sort keeps this linear
+// in the number of particles, leaving cellParticles[cellStart[b], cellStart[b + 1]) in bucket b
+void ParticleSystem::buildSpatialHash() {
+	int count = particlePos.size();
+	int tableSize = 1;
+	while (tableSize < count * 2) tableSize <<= 1;
+	int mask = tableSize - 1;
+	float inverseCellSize = 1.0f / (p_radius * 2.0f);
+
+	particleCell.resize(count);
+	ThreadPool::shared().parallelFor(count, particleChunkSize, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			int x = int(floor(particlePos.x[i] * inverseCellSize));
+			int y = int(floor(particlePos.y[i] * inverseCellSize));
+			int z = int(floor(particlePos.z[i] * inverseCellSize));
+			particleCell[i] = hashCell(x, y, z, mask);
 		}
+	});
+
+	// Count each bucket and sum the counts so each entry holds the end of its bucket
+	cellStart.assign(tableSize + 1, 0);
+	for (int i = 0; i < count; i++) {
+		cellStart[particleCell[i]]++;
 	}
+	for (int b = 1; b <= tableSize; b++) {
+		cellStart[b] += cellStart[b - 1];
+	}
+
+	// Filling each bucket from its end moves every entry back to the start of its bucket
+	cellParticles.resize(count);
+	for (int i = count - 1; i >= 0; i--) {
+		cellParticles[--cellStart[particleCell[i]]] = i;
+	}
+
+	// Gather the state in bucket order so neighbours are read from consecutive memory
+	sortedPos.resize(count);
+	sortedVel.resize(count);
+	ThreadPool::shared().parallelFor(count, particleChunkSize, [this](int begin, int end, int) {
+		for (int k = begin; k < end; k++) {
+			sortedPos.set(k, particlePos.get(cellParticles[k]));
+			sortedVel.set(k, particleVel.get(cellParticles[k]));
+		}
+	});
+}
+
+// Push overlapping particles apart and remove the velocity they approach each other with.
+// Each particle only sums the corrections it gets from its neighbours, so chunks never write
+// to each others particles, and a couple of iterations let contacts through a pile settle.
+// Sleeping particles are fixed obstacles, only awake particles are moved
+void ParticleSystem::resolveCollisions() {
+	int count = particlePos.size();
+	if (count == 0) return;
+
+	float diameter = p_radius * 2.0f;
+	float inverseCellSize = 1.0f / diameter;
+	posCorrection.resize(count);
+	velCorrection.resize(count);
 
-	// Interpolate the current colour based on the animation state
+	for (int iteration = 0; iteration < collisionIterations; iteration++) {
+		buildSpatialHash();
+		int mask = int(cellStart.size()) - 2;
+
+		ThreadPool::shared().parallelFor(awakeCount, particleChunkSize, [&](int begin, int end, int) {
+			for (int i = begin; i < end; i++) {
+				vec3 pos = particlePos.get(i);
+				vec3 vel = particleVel.get(i);
+				vec3 dp(0.0f, 0.0f, 0.0f);
+				vec3 dv(0.0f, 0.0f, 0.0f);
+
+				int x = int(floor(pos.x * inverseCellSize));
+				int y = int(floor(pos.y * inverseCellSize));
+				int z = int(floor(pos.z * inverseCellSize));
+
+				// Neighbours are at most one cell away, so check the nine rows of three cells around this one
+				for (int dy = -1; dy <= 1; dy++) {
+					for (int dz = -1; dz <= 1; dz++) {
+						auto collide = [&](int first, int last) {
+							for (int k = first; k < last; k++) {
+								if (cellParticles[k] == i) continue;
+
+								vec3 other = sortedPos.get(k);
+								vec3 offset = pos - other;
+								float distanceSquared = dot(offset, offset);
+								if (distanceSquared >= diameter * diameter || distanceSquared == 0.0f) continue;
+
+								// Rows can share buckets, so a neighbour only counts in the row it is in
+								if (int(floor(other.y * inverseCellSize)) != y + dy || int(floor(other.z * inverseCellSize)) != z + dz) continue;
+
+								// Two awake particles take half of the correction each, against a sleeping one it is all taken here
+								float share = cellParticles[k] < awakeCount ? 0.5f : 1.0f;
+								float distance = sqrt(distanceSquared);
+								vec3 normal = offset / distance;
+								dp += normal * ((diameter - distance) * share);
+
+								float approach = dot(vel - sortedVel.get(k), normal);
+								if (approach < 0.0f) dv -= normal * (approach * (1.0f + p_restitution) * share);
+							}
+						};
+
+						// The row's buckets may wrap around the end of the table
+						int first = hashCell(x - 1, y + dy, z + dz, mask);
+						int last = first + 3;
+						collide(cellStart[first], cellStart[std::min(last, mask + 1)]);
+						if (last > mask + 1) collide(cellStart[0], cellStart[last - mask - 1]);
+					}
+				}
+
+				posCorrection.set(i, dp);
+				velCorrection.set(i, dv);
+			}
+		});
+
+		ThreadPool::shared().parallelFor(awakeCount, particleChunkSize, [this](int begin, int end, int) {
+			applyCollisionCorrections(begin, end, particlePos.x.data(), particlePos.y.data(), particlePos.z.data(),
+				particleVel.x.data(), particleVel.y.data(), particleVel.z.data(),
+				posCorrection.x.data(), posCorrection.y.data(), posCorrection.z.data(),
+				velCorrection.x.data(), velCorrection.y.data(), velCorrection.z.data(), p_radius);
+		});
+	}
+}
+
+// Interpolate the current colour based on the animation state
+void ParticleSystem::updateColour() {
 	float lerp = animationStep / float(animationLength);
 	currentColour = mix(startColour, endColour, lerp);
 	animationStep = min(animationStep + 1, animationLength);
@@ -71,74 +342,291 @@ void ParticleSystem::render() {
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	glLineWidth(1);
 
-	for (int i = 0; i < particles.size(); i++) {
-		particle p = particles[i];
+	// Draw every particle in view in one call, from the latest published step if simulating on another thread
+	if (gpuSimulation.active()) {
+		stepGpuSimulation();
+		renderer.render(gpuSimulation.getPositionBuffer(), gpuSimulation.getParticleCount(), currentColour);
+	} else if (simulating) {
+		frames.acquire();
+		const particleFrame &frame = frames.front();
+		renderVisibleChunks(frame.positions, frame.chunkMin, frame.chunkMax, frame.colour);
+	} else {
+		computeChunkBounds(particlePos, chunkMin, chunkMax);
+		renderVisibleChunks(particlePos, chunkMin, chunkMax, currentColour);
+	}
+
+	glPopMatrix();
+
+	glDisable(GL_BLEND);
+}
 
-		glPushMatrix();
-		glTranslatef(p.pos.x, p.pos.y, p.pos.z);
+// Find the bounds of each chunk of particles
+void ParticleSystem::computeChunkBounds(const vec3Array &positions, vector<vec3> &minBounds, vector<vec3> &maxBounds) {
+	int count = positions.size();
+	int chunks = (count + particleChunkSize - 1) / particleChunkSize;
+	minBounds.resize(chunks);
+	maxBounds.resize(chunks);
 
-		glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, currentColour.dataPointer());
+	ThreadPool::shared().parallelFor(count, particleChunkSize, [&](int begin, int end, int chunk) {
+		const float *x = positions.x.data();
+		const float *y = positions.y.data();
+		const float *z = positions.z.data();
 
-		// Draw the particle
-		glCallList(p_displayList);
+		vec3 low(x[begin], y[begin], z[begin]);
+		vec3 high = low;
+		for (int i = begin + 1; i < end; i++) {
+			low = vec3(min(low.x, x[i]), min(low.y, y[i]), min(low.z, z[i]));
+			high = vec3(max(high.x, x[i]), max(high.y, y[i]), max(high.z, z[i]));
+		}
 
-		glPopMatrix();
+		minBounds[chunk] = low;
+		maxBounds[chunk] = high;
+	});
+}
+
+// Draw the chunks whose bounds are in view. When only some are, their particles are
+// gathered so they can still be drawn with a single call
+void ParticleSystem::renderVisibleChunks(const vec3Array &positions, const vector<vec3> &minBounds, const vector<vec3> &maxBounds, vec4 colour) {
+	Frustum frustum = Frustum::fromCurrentMatrices();
+	vec3 margin(p_radius, p_radius, p_radius);
+
+	int chunks = minBounds.size();
+	int visibleChunks = 0;
+	chunkVisible.resize(chunks);
+	for (int c = 0; c < chunks; c++) {
+		chunkVisible[c] = frustum.intersectsBox(minBounds[c] - margin, maxBounds[c] + margin);
+		if (chunkVisible[c]) visibleChunks++;
 	}
 
-	glPopMatrix();
+	if (visibleChunks == chunks) {
+		renderer.render(positions, colour);
+		return;
+	}
 
-	glDisable(GL_BLEND);
+	visiblePos.clear();
+	for (int c = 0; c < chunks; c++) {
+		if (!chunkVisible[c]) continue;
+
+		int begin = c * particleChunkSize;
+		int end = min(begin + particleChunkSize, int(positions.size()));
+		visiblePos.x.insert(visiblePos.x.end(), positions.x.begin() + begin, positions.x.begin() + end);
+		visiblePos.y.insert(visiblePos.y.end(), positions.y.begin() + begin, positions.y.begin() + end);
+		visiblePos.z.insert(visiblePos.z.end(), positions.z.begin() + begin, positions.z.begin() + end);
+	}
+
+	renderer.render(visiblePos, colour);
+}
+
+void ParticleSystem::startSimulation(float stepsPerSecond) {
+	if (simulating) return;
+
+	// The first frame is published here so there is always one to draw
+	publishFrame();
+
+	simulating = true;
+	simulationThread = thread(&ParticleSystem::simulationLoop, this, stepsPerSecond);
+}
+
+void ParticleSystem::stopSimulation() {
+
+	// Bring the GPU state back so the system carries on from where it was
+	if (gpuSimulation.active()) {
+		gpuSimulation.download(particlePos, particleVel);
+		gpuSimulation.release();
+		wakeAll();
+	}
+
+	if (!simulating) return;
+
+	simulating = false;
+	simulationThread.join();
+
+	// Triggers sent after the last step are applied here instead
+	runPendingCommands();
+}
+
+void ParticleSystem::setPaused(bool pause) {
+	paused = pause;
+}
+
+bool ParticleSystem::startGpuSimulation(float stepsPerSecond) {
+
+	// Collisions need neighbouring particles, which the per particle update shader cannot see
+	if (simulating || collisions) return false;
+	if (gpuSimulation.active()) return true;
+
+	if (!gpuSimulation.init(particlePos, particleVel, particleAcc)) return false;
+
+	gpuStepDuration = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / stepsPerSecond));
+	gpuNextStep = chrono::steady_clock::now();
+	return true;
+}
+
+// Run the GPU steps that have come due since the last frame
+void ParticleSystem::stepGpuSimulation() {
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+	for (int steps = 0; steps < maxCatchUpSteps && gpuNextStep <= now; steps++) {
+		if (!paused) {
+			gpuSimulation.step(p_maxVel, p_radius, p_floorDamping);
+			updateColour();
+		}
+		gpuNextStep += gpuStepDuration;
+	}
+
+	// Drop the steps that could not be caught up on rather than running them later
+	if (gpuNextStep <= now) gpuNextStep = now + gpuStepDuration;
 }
 
-// Setup the particle instance geometry
-void ParticleSystem::setupDisplayList() {
-	// Delete the old list if there is one
-	if (p_displayList) glDeleteLists(p_displayList, 1);
+void ParticleSystem::simulationLoop(float stepsPerSecond) {
+	chrono::steady_clock::duration stepDuration = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / stepsPerSecond));
+	chrono::steady_clock::time_point nextStep = chrono::steady_clock::now();
 
-	// Setup the new display list
-	p_displayList = glGenLists(1);
-	glNewList(p_displayList, GL_COMPILE);
+	while (simulating) {
+		bool changed = runPendingCommands();
+		if (!paused && !settled()) {
+			update();
+			changed = true;
+		}
 
-	// Draw the geometry
-	cgraSphere(p_radius, 6, 6);
+		// A settled system costs nothing per step, not even the copy for the render thread
+		if (changed) publishFrame();
+
+		// Fall behind by a few steps at most rather than trying to catch up on a long stall
+		nextStep += stepDuration;
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (now - nextStep > stepDuration * maxCatchUpSteps) nextStep = now;
+
+		this_thread::sleep_until(nextStep);
+	}
+}
 
-	glEndList();
+// Copy the current state into the triple buffer for the render thread
+void ParticleSystem::publishFrame() {
+	particleFrame &frame = frames.back();
+	frame.positions = particlePos;
+	frame.colour = currentColour;
+	computeChunkBounds(particlePos, frame.chunkMin, frame.chunkMax);
+	frames.publish();
+}
+
+// Run an animation trigger now, on the GPU state if simulating there, or queue it for the simulation thread
+void ParticleSystem::runCommand(const function<void()> &command) {
+	if (gpuSimulation.active()) {
+
+		// Triggers are rare, so apply them to a read back copy and upload the result
+		gpuSimulation.download(particlePos, particleVel);
+		command();
+		gpuSimulation.uploadPositions(particlePos);
+		gpuSimulation.uploadVelocities(particleVel);
+		gpuSimulation.uploadAccelerations(particleAcc);
+	} else if (simulating) {
+		lock_guard<mutex> lock(commandMutex);
+		commands.push_back(command);
+	} else {
+		command();
+	}
+}
+
+// Returns true if there were any to run
+bool ParticleSystem::runPendingCommands() {
+	vector<function<void()>> pending;
+	{
+		lock_guard<mutex> lock(commandMutex);
+		pending.swap(commands);
+	}
+
+	for (function<void()> &command : pending) {
+		command();
+	}
+
+	return !pending.empty();
+}
+
+void ParticleSystem::setCollisions(bool enabled) {
+	runCommand([this, enabled] {
+		collisions = enabled;
+	});
+}
+
+void ParticleSystem::setRenderMode(particleRenderMode mode) {
+	renderer.setRenderMode(mode);
 }
 
 // Make each particle fall from it's current position
 void ParticleSystem::drop() {
-	for (int i = 0; i < particles.size(); i++) {
-		particles[i].acc = vec3(0.0f, -0.00981f, 0.0f);
-		particles[i].vel = vec3(math::random(-1.0f, 1.0f) * p_velRange / 2.0f,
-			                      math::random(-0.01f, 0.0f),
-			                      math::random(-1.0f, 1.0f) * p_velRange / 2.0f);
-	}
+	runCommand([this] {
+		wakeAll();
+		parallelRandom([this](int begin, int end, mt19937 &random) {
+			uniform_real_distribution<float> spread(-1.0f, 1.0f);
+			uniform_real_distribution<float> fall(-0.01f, 0.0f);
+
+			for (int i = begin; i < end; i++) {
+				float x = spread(random) * p_velRange / 2.0f;
+				float y = fall(random);
+				float z = spread(random) * p_velRange / 2.0f;
+				particleVel.set(i, vec3(x, y, z));
+				particleAcc.set(i, vec3(0.0f, -0.00981f, 0.0f));
+			}
+		});
+	});
 }
 
 // Explode each particle in all directions
 void ParticleSystem::explode() {
-	for (int i = 0; i < particles.size(); i++) {
-		particles[i].acc = vec3(0.0f, -0.00981f, 0.0f);
-		particles[i].vel = vec3(math::random(-1.0f, 1.0f) * p_velRange * 10.0f,
-			                      math::random(-1.0f, 1.0f) * p_velRange * 10.0f,
-			                      math::random(-1.0f, 1.0f) * p_velRange * 10.0f);
-	}
+	runCommand([this] {
+		wakeAll();
+		parallelRandom([this](int begin, int end, mt19937 &random) {
+			uniform_real_distribution<float> spread(-1.0f, 1.0f);
+
+			for (int i = begin; i < end; i++) {
+				float x = spread(random) * p_velRange * 10.0f;
+				float y = spread(random) * p_velRange * 10.0f;
+				float z = spread(random) * p_velRange * 10.0f;
+				particleVel.set(i, vec3(x, y, z));
+				particleAcc.set(i, vec3(0.0f, -0.00981f, 0.0f));
+			}
+		});
+	});
 }
 
 // Attempt to blow the particle system away in the direction of a given wind vector
 void ParticleSystem::blowAway(vec3 direction) {
-	for (int i = 0; i < particles.size(); i++) {
-		particles[i].acc = vec3(0.0f, -0.000981f, 0.0f);
-		particles[i].acc += direction * math::random(1.0f, 5.0f);
-		particles[i].vel = direction;
-	}
+	runCommand([this, direction] {
+		wakeAll();
+		parallelRandom([this, direction](int begin, int end, mt19937 &random) {
+			uniform_real_distribution<float> strength(1.0f, 5.0f);
+
+			for (int i = begin; i < end; i++) {
+				particleVel.set(i, direction);
+				particleAcc.set(i, vec3(0.0f, -0.000981f, 0.0f) + direction * strength(random));
+			}
+		});
+	});
 }
 
 // Reset the particle system to it's initial state
 void ParticleSystem::resetParticles() {
-	for (int i = 0; i < particles.size(); i++) {
-		particles[i].pos = particles[i].original_pos;
-		particles[i].vel = vec3(0.0f, 0.0f, 0.0f);
-		particles[i].acc = vec3(0.0f, 0.0f, 0.0f);
-	}
+	runCommand([this] {
+		wakeAll();
+		ThreadPool::shared().parallelFor(particlePos.size(), particleChunkSize, [this](int begin, int end, int) {
+			for (int i = begin; i < end; i++) {
+				particlePos.set(i, originalPos.get(i));
+				particleVel.set(i, vec3(0.0f, 0.0f, 0.0f));
+				particleAcc.set(i, vec3(0.0f, 0.0f, 0.0f));
+			}
+		});
+	});
+}
+
+// Run func over chunks of particles in parallel, giving each chunk its own random
+// engine. Seeds depend only on the chunk index so results do not vary with thread count
+void ParticleSystem::parallelRandom(const function<void(int, int, mt19937&)> &func) {
+	unsigned seed = seedGenerator();
+
+	ThreadPool::shared().parallelFor(particlePos.size(), particleChunkSize, [&](int begin, int end, int chunk) {
+		seed_seq sequence = { seed, unsigned(chunk) };
+		mt19937 random(sequence);
+		func(begin, end, random);
+	});
 }
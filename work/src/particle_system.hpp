@@ -10,19 +10,31 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "gpu_particle_simulation.hpp"
 #include "opengl.hpp"
-
-struct particle {
-	cgra::vec3 original_pos;
-	cgra::vec3 pos;
-	cgra::vec3 vel;
-	cgra::vec3 acc;
-	cgra::vec3 col;
+#include "particle_renderer.hpp"
+#include "soa_vector.hpp"
+#include "triple_buffer.hpp"
+
+// The state of a system needed to draw one frame of it
+struct particleFrame {
+	vec3Array positions;
+	cgra::vec4 colour;
+
+	// Bounds of each chunk of positions, so chunks out of view can be skipped when drawn
+	std::vector<cgra::vec3> chunkMin;
+	std::vector<cgra::vec3> chunkMax;
 };
 
 class ParticleSystem {
@@ -37,6 +49,16 @@ class ParticleSystem {
 		void update();
 		void render();
 
+		// Step the system on its own thread at a fixed rate instead of calling update,
+		// render then draws the most recently finished step without waiting on it
+		void startSimulation(float stepsPerSecond = 60.0f);
+		void stopSimulation();
+		void setPaused(bool);
+
+		// Step the system on the GPU with transform feedback instead, at a fixed rate driven by
+		// render. Returns false if the driver cannot, in which case startSimulation can be used
+		bool startGpuSimulation(float stepsPerSecond = 60.0f);
+
 		// Animation triggers
 		void drop();
 		void explode();
@@ -44,14 +66,65 @@ class ParticleSystem {
 
 		void resetParticles();
 
+		// Toggle resolving contacts between particles after each step, on the CPU simulation only
+		void setCollisions(bool);
+
+		void setRenderMode(particleRenderMode);
+
 	private:
 
-		// System fields
-		std::vector<particle> particles;
-		GLuint p_displayList = 0;
+		// System fields, each particle attribute is stored as separate component arrays
+		vec3Array originalPos;
+		vec3Array particlePos;
+		vec3Array particleVel;
+		vec3Array particleAcc;
+
+		// Sleeping fields, awake particles are kept in [0, awakeCount) so only they are integrated
+		int awakeCount = 0;
+		std::vector<int> stillSteps; // Consecutive steps each particle has moved slower than p_sleepSpeed
+		int sleepSteps = 30;
+
+		// Particles are simulated in parallel chunks of this size, a multiple of the SIMD width
+		static const int particleChunkSize = 16384;
+		std::mt19937 seedGenerator = std::mt19937(std::random_device()());
+
+		// Drawing fields
+		ParticleRenderer renderer;
+		std::vector<cgra::vec3> chunkMin;
+		std::vector<cgra::vec3> chunkMax;
+		std::vector<char> chunkVisible;
+		vec3Array visiblePos; // Particles of the chunks in view, gathered into one draw
+
+		// Simulation thread fields
+		std::thread simulationThread;
+		std::atomic<bool> simulating { false };
+		std::atomic<bool> paused { false };
+		int maxCatchUpSteps = 5;
+		TripleBuffer<particleFrame> frames;
+		std::mutex commandMutex;
+		std::vector<std::function<void()>> commands; // Animation triggers waiting for the simulation thread
+
+		// GPU simulation fields
+		GpuParticleSimulation gpuSimulation;
+		std::chrono::steady_clock::duration gpuStepDuration;
+		std::chrono::steady_clock::time_point gpuNextStep;
+
+		// Collision fields, particles are bucketed each step into a hashed grid of cells one particle wide
+		bool collisions = false;
+		int collisionIterations = 2;
+		std::vector<int> particleCell;
+		std::vector<int> cellStart;
+		std::vector<int> cellParticles;
+		vec3Array sortedPos;
+		vec3Array sortedVel;
+		vec3Array posCorrection;
+		vec3Array velCorrection;
 
 		// Particle fields
 		float p_radius = 0.2f;
+		float p_floorDamping = 0.9f;
+		float p_restitution = 0.3f;
+		float p_sleepSpeed = 0.01f;
 		float p_velRange = 0.03f;
 		float p_maxVel = 0.5f;
 
@@ -67,5 +140,19 @@ class ParticleSystem {
 		cgra::vec4 startColour = cgra::vec4(1.0, 1.0, 1.0, 1.0);
 		cgra::vec4 endColour = cgra::vec4(1.0, 0.2, 0.0, 0.0);
 
-		void setupDisplayList();
+		void updateColour();
+		void updateSleeping();
+		void wakeAll();
+		void swapParticles(int, int);
+		bool settled();
+		void buildSpatialHash();
+		void resolveCollisions();
+		void stepGpuSimulation();
+		void parallelRandom(const std::function<void(int, int, std::mt19937&)>&);
+		void computeChunkBounds(const vec3Array&, std::vector<cgra::vec3>&, std::vector<cgra::vec3>&);
+		void renderVisibleChunks(const vec3Array&, const std::vector<cgra::vec3>&, const std::vector<cgra::vec3>&, cgra::vec4);
+		void runCommand(const std::function<void()>&);
+		bool runPendingCommands();
+		void publishFrame();
+		void simulationLoop(float);
 };
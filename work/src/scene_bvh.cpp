@@ -0,0 +1,126 @@
+//---------------------------------------------------------------------------
+// Bounding Volume Hierarchy over Scene Objects
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "frustum.hpp"
+#include "scene_bvh.hpp"
+
+using namespace std;
+using namespace cgra;
+
+// Maximum number of objects stored in a leaf node
+static const int maxLeafSize = 2;
+
+void SceneBVH::build(const vector<vec3> &minBounds, const vector<vec3> &maxBounds) {
+	nodes.clear();
+	objectIndices.clear();
+	objectMin.clear();
+	objectMax.clear();
+
+	int objectCount = minBounds.size();
+	if (objectCount == 0) return;
+
+	// Objects are partitioned by the centres of their boxes
+	vector<vec3> centres(objectCount);
+	for (int i = 0; i < objectCount; i++) {
+		centres[i] = (minBounds[i] + maxBounds[i]) * 0.5f;
+		objectIndices.push_back(i);
+	}
+
+	objectMin = minBounds;
+	objectMax = maxBounds;
+
+	nodes.reserve(objectCount * 2 / maxLeafSize + 1);
+	buildNode(centres, 0, objectCount);
+
+	// Store the boxes in leaf order for the leaf tests
+	for (int i = 0; i < objectCount; i++) {
+		objectMin[i] = minBounds[objectIndices[i]];
+		objectMax[i] = maxBounds[objectIndices[i]];
+	}
+}
+
+// Recursively build the node covering objects [begin, end), splitting at the
+// median centre along the longest axis. Returns the index of the new node
+int SceneBVH::buildNode(const vector<vec3> &centres, int begin, int end) {
+	int nodeIndex = nodes.size();
+	nodes.push_back(bvhNode());
+
+	float inf = numeric_limits<float>::max();
+	vec3 minBounds = vec3(inf, inf, inf);
+	vec3 maxBounds = vec3(-inf, -inf, -inf);
+	vec3 minCentre = minBounds;
+	vec3 maxCentre = maxBounds;
+
+	for (int i = begin; i < end; i++) {
+		int o = objectIndices[i];
+		minBounds = cgra::min(minBounds, objectMin[o]);
+		maxBounds = cgra::max(maxBounds, objectMax[o]);
+		minCentre = cgra::min(minCentre, centres[o]);
+		maxCentre = cgra::max(maxCentre, centres[o]);
+	}
+
+	nodes[nodeIndex].minBounds = minBounds;
+	nodes[nodeIndex].maxBounds = maxBounds;
+
+	vec3 extent = maxCentre - minCentre;
+	if (end - begin <= maxLeafSize || (extent.x <= 0.0f && extent.y <= 0.0f && extent.z <= 0.0f)) {
+		nodes[nodeIndex].start = begin;
+		nodes[nodeIndex].count = end - begin;
+		return nodeIndex;
+	}
+
+	int axis = 0;
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	int mid = (begin + end) / 2;
+	nth_element(objectIndices.begin() + begin, objectIndices.begin() + mid, objectIndices.begin() + end, [&](int a, int b) {
+		return centres[a][axis] < centres[b][axis];
+	});
+
+	// The left child always directly follows its parent
+	buildNode(centres, begin, mid);
+	int right = buildNode(centres, mid, end);
+
+	nodes[nodeIndex].start = right;
+	nodes[nodeIndex].count = 0;
+	return nodeIndex;
+}
+
+bool SceneBVH::empty() const {
+	return nodes.empty();
+}
+
+void SceneBVH::cull(const Frustum &frustum, vector<int> &visible) const {
+	if (nodes.empty()) return;
+	cullNode(0, frustum, false, visible);
+}
+
+// Once a node is found wholly inside the frustum everything below it is too
+void SceneBVH::cullNode(int nodeIndex, const Frustum &frustum, bool inside, vector<int> &visible) const {
+	const bvhNode &node = nodes[nodeIndex];
+
+	if (!inside) {
+		frustumTest test = frustum.testBox(node.minBounds, node.maxBounds);
+		if (test == frustumTest::outside) return;
+		inside = test == frustumTest::inside;
+	}
+
+	if (node.count > 0) {
+		for (int i = node.start; i < node.start + node.count; i++) {
+			if (inside || frustum.intersectsBox(objectMin[i], objectMax[i])) visible.push_back(objectIndices[i]);
+		}
+		return;
+	}
+
+	cullNode(nodeIndex + 1, frustum, inside, visible);
+	cullNode(node.start, frustum, inside, visible);
+}
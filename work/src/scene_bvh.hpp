@@ -0,0 +1,38 @@
+//---------------------------------------------------------------------------
+// Bounding Volume Hierarchy over Scene Objects
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "frustum.hpp"
+#include "triangle_bvh.hpp"
+
+// Hierarchy of the boxes bounding the objects in a scene, so the ones in view can be
+// found by descending only into the nodes the frustum reaches. Nodes wholly inside the
+// frustum take all of their objects without testing them one by one
+class SceneBVH {
+
+	public:
+		// Build the hierarchy from the minimum and maximum corners of each object's box
+		void build(const std::vector<cgra::vec3>&, const std::vector<cgra::vec3>&);
+		bool empty() const;
+
+		// Appends the index of every object whose box is at least partly inside the frustum
+		void cull(const Frustum&, std::vector<int>&) const;
+
+	private:
+		std::vector<bvhNode> nodes;
+
+		// Object indices and boxes reordered so each leaf references a contiguous range
+		std::vector<int> objectIndices;
+		std::vector<cgra::vec3> objectMin;
+		std::vector<cgra::vec3> objectMax;
+
+		int buildNode(const std::vector<cgra::vec3>&, int, int);
+		void cullNode(int, const Frustum&, bool, std::vector<int>&) const;
+};
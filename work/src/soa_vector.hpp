@@ -0,0 +1,129 @@
+//---------------------------------------------------------------------------
+// Aligned Structure of Arrays Storage
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "cgra_math.hpp"
+
+// Alignment of particle component arrays, wide enough for 256 bit SIMD loads
+const std::size_t simdAlignment = 32;
+
+// Allocator that returns memory aligned to the given boundary
+template <typename T, std::size_t Alignment = simdAlignment>
+struct alignedAllocator {
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind {
+		typedef alignedAllocator<U, Alignment> other;
+	};
+
+	alignedAllocator() noexcept {}
+	template <typename U>
+	alignedAllocator(const alignedAllocator<U, Alignment>&) noexcept {}
+
+	T* allocate(std::size_t n) {
+		if (n == 0) return nullptr;
+		void *ptr = nullptr;
+#ifdef _WIN32
+		ptr = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+		if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0) ptr = nullptr;
+#endif
+		if (!ptr) throw std::bad_alloc();
+		return static_cast<T*>(ptr);
+	}
+
+	void deallocate(T *ptr, std::size_t) noexcept {
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
+};
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator==(const alignedAllocator<T, Alignment>&, const alignedAllocator<U, Alignment>&) { return true; }
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator!=(const alignedAllocator<T, Alignment>&, const alignedAllocator<U, Alignment>&) { return false; }
+
+template <typename T>
+using alignedVector = std::vector<T, alignedAllocator<T>>;
+
+// A collection of vec3 values stored as three separate aligned component arrays
+// so that loops over a single component stream through contiguous memory
+struct vec3Array {
+	alignedVector<float> x;
+	alignedVector<float> y;
+	alignedVector<float> z;
+
+	std::size_t size() const { return x.size(); }
+
+	void reserve(std::size_t n) {
+		x.reserve(n);
+		y.reserve(n);
+		z.reserve(n);
+	}
+
+	void resize(std::size_t n, cgra::vec3 v = cgra::vec3(0.0f, 0.0f, 0.0f)) {
+		x.resize(n, v.x);
+		y.resize(n, v.y);
+		z.resize(n, v.z);
+	}
+
+	void clear() {
+		x.clear();
+		y.clear();
+		z.clear();
+	}
+
+	void push_back(cgra::vec3 v) {
+		x.push_back(v.x);
+		y.push_back(v.y);
+		z.push_back(v.z);
+	}
+
+	cgra::vec3 get(std::size_t i) const {
+		return cgra::vec3(x[i], y[i], z[i]);
+	}
+
+	void set(std::size_t i, cgra::vec3 v) {
+		x[i] = v.x;
+		y[i] = v.y;
+		z[i] = v.z;
+	}
+
+	// Set every element to the given value
+	void fill(cgra::vec3 v) {
+		for (std::size_t i = 0; i < x.size(); i++) {
+			x[i] = v.x;
+			y[i] = v.y;
+			z[i] = v.z;
+		}
+	}
+
+	// Copy the element at one index over the element at another, used when compacting
+	void move(std::size_t from, std::size_t to) {
+		x[to] = x[from];
+		y[to] = y[from];
+		z[to] = z[from];
+	}
+
+	// Exchange the elements at two indices, used when reordering
+	void swap(std::size_t a, std::size_t b) {
+		std::swap(x[a], x[b]);
+		std::swap(y[a], y[b]);
+		std::swap(z[a], z[b]);
+	}
+};
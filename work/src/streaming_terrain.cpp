@@ -0,0 +1,470 @@
+//---------------------------------------------------------------------------
+// Streaming Tiled Terrain
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "file_cache.hpp"
+#include "frustum.hpp"
+#include "geometry.hpp"
+#include "opengl.hpp"
+#include "streaming_terrain.hpp"
+
+using namespace std;
+using namespace cgra;
+
+// Identifies the binary layout of tile files
+static const uint32_t terrainFileMagic = 0x314E5254; // "TRN1"
+
+// Start of a tile file, followed by a record for every tile and then the tiles' data
+struct terrainFileHeader {
+	uint32_t magic;
+	int tileCount;
+	uint64_t key;
+};
+
+// Where a tile's points, uvs, normals and triangles are in the file, and the space they cover
+struct terrainTileRecord {
+	vec3 minBounds;
+	vec3 maxBounds;
+	int points;
+	int uvs;
+	int normals;
+	int triangles;
+	uint64_t offset;
+};
+
+// Returns the index an element has in a tile, copying it into the tile on first use. Invalid
+// indices go to the tile's dummy element at 0
+template <typename T>
+static int tileIndex(int index, const vector<T> &elements, vector<int> &map, vector<T> &tileElements) {
+	if (index <= 0 || size_t(index) >= elements.size()) return 0;
+
+	if (!map[index]) {
+		map[index] = tileElements.size();
+		tileElements.push_back(elements[index]);
+	}
+	return map[index];
+}
+
+StreamingTerrain::StreamingTerrain(string filename, float texScale, int tilesPerSide) {
+	textureScale = texScale;
+
+	// Tiles are rebuilt whenever the source file or the way it is split changes
+	uint64_t size = 0;
+	int64_t modified = 0;
+	if (fileStamp(filename, size, modified)) {
+		uint64_t key = hashBytes(filename.data(), filename.size());
+		key = hashBytes(&size, sizeof(size), key);
+		key = hashBytes(&modified, sizeof(modified), key);
+		key = hashBytes(&tilesPerSide, sizeof(tilesPerSide), key);
+		tileFilename = cacheFilePath(key, ".terrain");
+
+		if (!readTileFile(key)) splitTiles(filename, key, tilesPerSide);
+	} else {
+		cerr << "Error reading terrain " << filename << endl;
+	}
+
+	// Tiles are culled against the view through a hierarchy of their bounds
+	vector<vec3> minBounds, maxBounds;
+	for (terrainTile &tile : tiles) {
+		minBounds.push_back(tile.minBounds);
+		maxBounds.push_back(tile.maxBounds);
+	}
+	tileBVH.build(minBounds, maxBounds);
+
+	// Default material setting
+	tileMaterial.ambient = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	tileMaterial.diffuse = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	tileMaterial.specular = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	tileMaterial.shininess = 0.0f;
+	tileMaterial.emission = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+
+	loaderThread = thread(&StreamingTerrain::loaderLoop, this);
+}
+
+StreamingTerrain::~StreamingTerrain() {
+	{
+		lock_guard<mutex> lock(loaderMutex);
+		stopping = true;
+	}
+	loaderWake.notify_all();
+	loaderThread.join();
+
+	for (terrainTile &tile : tiles) {
+		delete tile.geometry;
+	}
+	for (pair<int, Geometry*> &loaded : loadedTiles) {
+		delete loaded.second;
+	}
+}
+
+// Read the tile records, returns false if the file is missing or was made for a different source
+bool StreamingTerrain::readTileFile(uint64_t key) {
+	ifstream file(tileFilename, ios::binary | ios::ate);
+	if (!file.is_open()) return false;
+
+	uint64_t fileSize = file.tellg();
+	file.seekg(0);
+
+	terrainFileHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || header.magic != terrainFileMagic || header.key != key || header.tileCount <= 0) return false;
+
+	vector<terrainTileRecord> records(header.tileCount);
+	file.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(terrainTileRecord));
+	if (!file) return false;
+
+	tiles.assign(records.size(), terrainTile());
+	for (size_t i = 0; i < records.size(); i++) {
+		const terrainTileRecord &record = records[i];
+		uint64_t end = record.offset + uint64_t(record.points) * sizeof(vec3) + uint64_t(record.uvs) * sizeof(vec2) +
+			uint64_t(record.normals) * sizeof(vec3) + uint64_t(record.triangles) * sizeof(triangle);
+		if (record.points < 0 || record.uvs < 0 || record.normals < 0 || record.triangles < 0 || end > fileSize) {
+			tiles.clear();
+			return false;
+		}
+
+		terrainTile &tile = tiles[i];
+		tile.minBounds = record.minBounds;
+		tile.maxBounds = record.maxBounds;
+		tile.offset = record.offset;
+		tile.points = record.points;
+		tile.uvs = record.uvs;
+		tile.normals = record.normals;
+		tile.triangles = record.triangles;
+	}
+
+	return true;
+}
+
+// Split the source mesh into a grid of tiles, giving each triangle to the tile its centre
+// lies in, then write them to the tile file. This is the only time the whole mesh is held
+// in memory at once, unless the file cannot be written and the tiles are kept instead
+void StreamingTerrain::splitTiles(const string &filename, uint64_t key, int tilesPerSide) {
+	cout << "Splitting terrain " << filename << " into " << tilesPerSide << "x" << tilesPerSide << " tiles" << endl;
+
+	Geometry source(filename);
+	const vector<vec3> &points = source.getPoints();
+	const vector<vec2> &uvs = source.getUvs();
+	const vector<vec3> &normals = source.getNormals();
+	const vector<triangle> &triangles = source.getTriangles();
+
+	vec3 minBounds = source.getMinBounds();
+	vec3 maxBounds = source.getMaxBounds();
+	float tileWidth = max((maxBounds.x - minBounds.x) / tilesPerSide, 1e-6f);
+	float tileDepth = max((maxBounds.z - minBounds.z) / tilesPerSide, 1e-6f);
+
+	// Bucket the triangles by tile
+	int tileTotal = tilesPerSide * tilesPerSide;
+	vector<int> triangleTile(triangles.size());
+	vector<int> firstTriangle(tileTotal + 1, 0);
+	for (size_t i = 0; i < triangles.size(); i++) {
+		vec3 centre = vec3(0.0f, 0.0f, 0.0f);
+		for (int j = 0; j < 3; j++) {
+			int p = triangles[i].v[j].p;
+			if (size_t(p) < points.size()) centre += points[p] / 3.0f;
+		}
+
+		int x = min(max(int((centre.x - minBounds.x) / tileWidth), 0), tilesPerSide - 1);
+		int z = min(max(int((centre.z - minBounds.z) / tileDepth), 0), tilesPerSide - 1);
+		triangleTile[i] = z * tilesPerSide + x;
+		firstTriangle[triangleTile[i] + 1]++;
+	}
+	for (int i = 0; i < tileTotal; i++) {
+		firstTriangle[i + 1] += firstTriangle[i];
+	}
+
+	vector<int> tileTriangles(triangles.size());
+	vector<int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (size_t i = 0; i < triangles.size(); i++) {
+		tileTriangles[filled[triangleTile[i]]++] = int(i);
+	}
+
+	// Each tile gets its own copy of the elements its triangles use, reindexed from 1 after a dummy
+	vector<int> pointMap(points.size(), 0);
+	vector<int> uvMap(uvs.size(), 0);
+	vector<int> normalMap(normals.size(), 0);
+
+	vector<terrainTileData> tileMeshes(tileTotal);
+	tiles.assign(tileTotal, terrainTile());
+
+	for (int t = 0; t < tileTotal; t++) {
+		vector<vec3> &tilePoints = tileMeshes[t].points;
+		vector<vec2> &tileUvs = tileMeshes[t].uvs;
+		vector<vec3> &tileNormals = tileMeshes[t].normals;
+		vector<triangle> &tileTriangleList = tileMeshes[t].triangles;
+		tilePoints.push_back(vec3(0.0f, 0.0f, 0.0f));
+		tileUvs.push_back(vec2(0.0f, 0.0f));
+		tileNormals.push_back(vec3(0.0f, 0.0f, 1.0f));
+
+		for (int k = firstTriangle[t]; k < firstTriangle[t + 1]; k++) {
+			triangle tri = triangles[tileTriangles[k]];
+			for (int j = 0; j < 3; j++) {
+				vertex &v = tri.v[j];
+				v.p = tileIndex(v.p, points, pointMap, tilePoints);
+				v.t = tileIndex(v.t, uvs, uvMap, tileUvs);
+				v.n = tileIndex(v.n, normals, normalMap, tileNormals);
+			}
+			tileTriangleList.push_back(tri);
+		}
+
+		// Clear the maps for the next tile by walking back over what this tile used
+		for (int k = firstTriangle[t]; k < firstTriangle[t + 1]; k++) {
+			const triangle &tri = triangles[tileTriangles[k]];
+			for (int j = 0; j < 3; j++) {
+				if (size_t(tri.v[j].p) < points.size()) pointMap[tri.v[j].p] = 0;
+				if (size_t(tri.v[j].t) < uvs.size()) uvMap[tri.v[j].t] = 0;
+				if (size_t(tri.v[j].n) < normals.size()) normalMap[tri.v[j].n] = 0;
+			}
+		}
+
+		terrainTile &tile = tiles[t];
+		if (tilePoints.size() > 1) {
+			tile.minBounds = tile.maxBounds = tilePoints[1];
+			for (size_t i = 2; i < tilePoints.size(); i++) {
+				tile.minBounds = cgra::min(tile.minBounds, tilePoints[i]);
+				tile.maxBounds = cgra::max(tile.maxBounds, tilePoints[i]);
+			}
+		}
+		tile.points = tilePoints.size();
+		tile.uvs = tileUvs.size();
+		tile.normals = tileNormals.size();
+		tile.triangles = tileTriangleList.size();
+	}
+
+	if (!writeTileFile(key, tileMeshes)) {
+		cerr << "Could not write terrain tiles " << tileFilename << ", keeping them in memory" << endl;
+		tileData.swap(tileMeshes);
+	}
+}
+
+// Write the split tiles to the tile file, recording where each one starts. Returns false if
+// the file could not be written in full
+bool StreamingTerrain::writeTileFile(uint64_t key, const vector<terrainTileData> &tileMeshes) {
+	ofstream file(tileFilename, ios::binary);
+	if (!file.is_open()) return false;
+
+	// The records are written again once every tile's offset is known
+	terrainFileHeader header = { terrainFileMagic, int(tiles.size()), key };
+	vector<terrainTileRecord> records(tiles.size());
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(terrainTileRecord));
+
+	for (size_t t = 0; t < tiles.size(); t++) {
+		const terrainTileData &mesh = tileMeshes[t];
+		tiles[t].offset = file.tellp();
+
+		terrainTileRecord &record = records[t];
+		record.minBounds = tiles[t].minBounds;
+		record.maxBounds = tiles[t].maxBounds;
+		record.points = tiles[t].points;
+		record.uvs = tiles[t].uvs;
+		record.normals = tiles[t].normals;
+		record.triangles = tiles[t].triangles;
+		record.offset = tiles[t].offset;
+
+		file.write(reinterpret_cast<const char*>(mesh.points.data()), mesh.points.size() * sizeof(vec3));
+		file.write(reinterpret_cast<const char*>(mesh.uvs.data()), mesh.uvs.size() * sizeof(vec2));
+		file.write(reinterpret_cast<const char*>(mesh.normals.data()), mesh.normals.size() * sizeof(vec3));
+		file.write(reinterpret_cast<const char*>(mesh.triangles.data()), mesh.triangles.size() * sizeof(triangle));
+	}
+
+	file.seekp(sizeof(header));
+	file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(terrainTileRecord));
+	file.close();
+	return !file.fail();
+}
+
+// Read tiles as they are asked for until the terrain is destroyed
+void StreamingTerrain::loaderLoop() {
+	while (true) {
+		int index;
+		{
+			unique_lock<mutex> lock(loaderMutex);
+			loaderWake.wait(lock, [this] { return stopping || !requestedTiles.empty(); });
+			if (stopping) return;
+
+			index = requestedTiles.front();
+			requestedTiles.pop_front();
+		}
+
+		Geometry *geometry = loadTile(index);
+
+		lock_guard<mutex> lock(loaderMutex);
+		loadedTiles.push_back(make_pair(index, geometry));
+	}
+}
+
+// Build the geometry of a tile from the file, or the copy kept in memory when there is no
+// file, returns null if it could not be read. The geometry is only uploaded to the GPU once
+// it is first drawn on the main thread
+Geometry* StreamingTerrain::loadTile(int index) {
+	const terrainTile &tile = tiles[index];
+
+	vector<vec3> points;
+	vector<vec2> uvs;
+	vector<vec3> normals;
+	vector<triangle> triangles;
+
+	if (!tileData.empty()) {
+		points = tileData[index].points;
+		uvs = tileData[index].uvs;
+		normals = tileData[index].normals;
+		triangles = tileData[index].triangles;
+	} else {
+		ifstream file(tileFilename, ios::binary);
+		if (!file.is_open()) return nullptr;
+		file.seekg(tile.offset);
+
+		points.resize(tile.points);
+		uvs.resize(tile.uvs);
+		normals.resize(tile.normals);
+		triangles.resize(tile.triangles);
+		file.read(reinterpret_cast<char*>(points.data()), points.size() * sizeof(vec3));
+		file.read(reinterpret_cast<char*>(uvs.data()), uvs.size() * sizeof(vec2));
+		file.read(reinterpret_cast<char*>(normals.data()), normals.size() * sizeof(vec3));
+		file.read(reinterpret_cast<char*>(triangles.data()), triangles.size() * sizeof(triangle));
+		if (!file) return nullptr;
+	}
+
+	for (vec2 &uv : uvs) {
+		uv *= textureScale;
+	}
+
+	// Weld here rather than on the first draw, which happens on the render thread
+	Geometry *geometry = new Geometry(points, normals, uvs, triangles, true);
+	geometry->buildVertexData();
+	return geometry;
+}
+
+void StreamingTerrain::update(vec3 viewPosition) {
+	frame++;
+
+	// Take on a few of the tiles the loader has finished
+	{
+		lock_guard<mutex> lock(loaderMutex);
+		int taken = min(int(loadedTiles.size()), maxUploadsPerFrame);
+		for (int i = 0; i < taken; i++) {
+			terrainTile &tile = tiles[loadedTiles[i].first];
+			tile.loading = false;
+			tile.geometry = loadedTiles[i].second;
+			if (!tile.geometry) {
+				cerr << "Error reading terrain tile " << loadedTiles[i].first << " from " << tileFilename << endl;
+				tile.failed = true;
+				continue;
+			}
+
+			tile.geometry->setMaterial(tileMaterial.ambient, tileMaterial.diffuse, tileMaterial.specular, tileMaterial.shininess, tileMaterial.emission);
+			residentTiles++;
+		}
+		loadedTiles.erase(loadedTiles.begin(), loadedTiles.begin() + taken);
+	}
+
+	// Find the nearest tiles in range, as many as may be resident at once
+	vector<pair<float, int>> wanted;
+	for (size_t i = 0; i < tiles.size(); i++) {
+		if (tiles[i].triangles == 0 || tiles[i].failed) continue;
+
+		vec3 closest = clamp(viewPosition, tiles[i].minBounds, tiles[i].maxBounds);
+		float d = distance(viewPosition, closest);
+		if (d <= loadRadius) wanted.push_back(make_pair(d, int(i)));
+	}
+	sort(wanted.begin(), wanted.end());
+	if (wanted.size() > size_t(maxResidentTiles)) wanted.resize(maxResidentTiles);
+
+	// Replace the tiles still waiting to be read with the ones wanted now, nearest first
+	{
+		lock_guard<mutex> lock(loaderMutex);
+		for (int index : requestedTiles) {
+			tiles[index].loading = false;
+		}
+		requestedTiles.clear();
+
+		for (pair<float, int> &w : wanted) {
+			terrainTile &tile = tiles[w.second];
+			tile.lastUsed = frame;
+			if (tile.geometry || tile.loading) continue;
+
+			tile.loading = true;
+			requestedTiles.push_back(w.second);
+		}
+	}
+	loaderWake.notify_one();
+
+	// Drop the least recently wanted tiles until back within the limit
+	if (residentTiles > maxResidentTiles) {
+		vector<pair<int, int>> resident;
+		for (size_t i = 0; i < tiles.size(); i++) {
+			if (tiles[i].geometry && tiles[i].lastUsed != frame) resident.push_back(make_pair(tiles[i].lastUsed, int(i)));
+		}
+		sort(resident.begin(), resident.end());
+
+		for (size_t i = 0; i < resident.size() && residentTiles > maxResidentTiles; i++) {
+			evictTile(resident[i].second);
+		}
+	}
+}
+
+void StreamingTerrain::evictTile(int index) {
+	delete tiles[index].geometry;
+	tiles[index].geometry = nullptr;
+	residentTiles--;
+}
+
+void StreamingTerrain::renderTerrain(bool wireframe) {
+
+	// The camera sits at the origin of eye space, so the inverse modelview matrix takes it into terrain space
+	mat4 projection, modelview;
+	glGetFloatv(GL_PROJECTION_MATRIX, projection.dataPointer());
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview.dataPointer());
+	vec4 eye = inverse(modelview) * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	update(vec3(eye.x, eye.y, eye.z) / eye.w);
+
+	// Tiles behind the camera stay loaded for when it turns, they are just not drawn
+	visibleTiles.clear();
+	tileBVH.cull(Frustum(projection, modelview), visibleTiles);
+
+	for (int index : visibleTiles) {
+		if (tiles[index].geometry) tiles[index].geometry->renderGeometry(wireframe);
+	}
+}
+
+void StreamingTerrain::setMaterial(vec4 ambient, vec4 diffuse, vec4 specular, float shininess, vec4 emission) {
+	tileMaterial.ambient = ambient;
+	tileMaterial.diffuse = diffuse;
+	tileMaterial.specular = specular;
+	tileMaterial.shininess = shininess;
+	tileMaterial.emission = emission;
+
+	for (terrainTile &tile : tiles) {
+		if (tile.geometry) tile.geometry->setMaterial(ambient, diffuse, specular, shininess, emission);
+	}
+}
+
+void StreamingTerrain::setLoadRadius(float radius) {
+	loadRadius = radius;
+}
+
+void StreamingTerrain::setMaxResidentTiles(int count) {
+	maxResidentTiles = max(1, count);
+}
+
+int StreamingTerrain::tileCount() {
+	return tiles.size();
+}
+
+int StreamingTerrain::residentTileCount() {
+	return residentTiles;
+}
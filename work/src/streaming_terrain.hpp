@@ -0,0 +1,104 @@
+//---------------------------------------------------------------------------
+// Streaming Tiled Terrain
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "geometry.hpp"
+#include "scene_bvh.hpp"
+
+struct terrainTile {
+	cgra::vec3 minBounds;
+	cgra::vec3 maxBounds;
+	uint64_t offset = 0; // Where the tile's data starts in the tile file
+	int points = 0;
+	int uvs = 0;
+	int normals = 0;
+	int triangles = 0;
+
+	Geometry *geometry = nullptr; // Set while the tile is resident
+	bool loading = false;
+	bool failed = false; // Set if the tile could not be read, so it is not requested again
+	int lastUsed = 0; // Frame the tile was last wanted, for least recently used eviction
+};
+
+// Mesh of a tile, only held when the tile file could not be written
+struct terrainTileData {
+	std::vector<cgra::vec3> points;
+	std::vector<cgra::vec2> uvs;
+	std::vector<cgra::vec3> normals;
+	std::vector<triangle> triangles;
+};
+
+// A terrain mesh split into a grid of tiles over the XZ plane. The tiles are written
+// once to a file in the cache directory along with their bounds, then read back on a
+// loader thread as the camera comes near them. Only a limited number of tiles are
+// kept in memory, dropping the ones least recently in range to make room
+class StreamingTerrain {
+
+	public:
+		StreamingTerrain(std::string, float texScale = 1.0f, int tilesPerSide = 8);
+		~StreamingTerrain();
+
+		StreamingTerrain(const StreamingTerrain&) = delete;
+		StreamingTerrain& operator=(const StreamingTerrain&) = delete;
+
+		void setMaterial(cgra::vec4, cgra::vec4, cgra::vec4, float, cgra::vec4);
+
+		// Tiles within this distance of the camera are loaded, nearest first
+		void setLoadRadius(float);
+		void setMaxResidentTiles(int);
+
+		// Stream tiles around the camera found from the current modelview matrix, then draw the resident tiles in view
+		void renderTerrain(bool);
+
+		// Request and evict tiles for a camera at the given point in terrain space
+		void update(cgra::vec3);
+
+		int tileCount();
+		int residentTileCount();
+
+	private:
+		std::string tileFilename;
+		std::vector<terrainTile> tiles;
+		std::vector<terrainTileData> tileData; // Empty unless the tiles are kept in memory
+		SceneBVH tileBVH;
+		std::vector<int> visibleTiles; // Tiles found in view by the last draw
+		float textureScale = 1.0f;
+		float loadRadius = 400.0f;
+		int maxResidentTiles = 64;
+		int residentTiles = 0;
+		int frame = 0;
+
+		// Newly loaded tiles made resident per update, each is uploaded on its first draw
+		int maxUploadsPerFrame = 4;
+
+		material tileMaterial;
+
+		// Loader thread fields, the tiles it has been asked for nearest first and the tiles it has read
+		std::thread loaderThread;
+		std::mutex loaderMutex;
+		std::condition_variable loaderWake;
+		std::deque<int> requestedTiles;
+		std::vector<std::pair<int, Geometry*>> loadedTiles;
+		bool stopping = false;
+
+		bool readTileFile(uint64_t);
+		void splitTiles(const std::string&, uint64_t, int);
+		bool writeTileFile(uint64_t, const std::vector<terrainTileData>&);
+		void loaderLoop();
+		Geometry* loadTile(int);
+		void evictTile(int);
+};
@@ -0,0 +1,137 @@
+//---------------------------------------------------------------------------
+// Fast In Place Text Parsing
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Helpers for reading numbers straight out of a character buffer such as a memory
+// mapped file. The end of the buffer is always passed in, so it does not need to be
+// null terminated, and nothing is allocated. Each returns the position just past
+// what it read, or the position it was given if there was nothing to read there
+
+// Spaces within a line, a carriage return is treated as one so CRLF files read the same
+inline bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+inline const char* skipBlanks(const char *c, const char *end) {
+	while (c < end && isBlank(*c)) c++;
+	return c;
+}
+
+// Position of the start of the next line
+inline const char* skipLine(const char *c, const char *end) {
+	const char *newline = static_cast<const char*>(memchr(c, '\n', end - c));
+	return newline ? newline + 1 : end;
+}
+
+inline const char* parseInt(const char *c, const char *end, int &value) {
+	const char *start = c;
+	bool negative = false;
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		c++;
+	}
+
+	if (c == end || !isDigit(*c)) return start;
+
+	int result = 0;
+	while (c < end && isDigit(*c)) {
+		result = result * 10 + (*c - '0');
+		c++;
+	}
+
+	value = negative ? -result : result;
+	return c;
+}
+
+// Reads the same numbers as strtof. The significant digits are gathered into an integer,
+// and when that and the power of ten scaling it are both exact as floats the result is a
+// single correctly rounded multiply or divide. That covers the 6 to 8 digits most exporters
+// write, anything else is handed to strtof rather than rounding twice through a double
+inline const char* parseFloat(const char *c, const char *end, float &value) {
+	static const float powersOfTen[] = {
+		1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+	};
+	const uint64_t mantissaLimit = 1000000000000000000ull;
+
+	const char *start = c;
+	bool negative = false;
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		c++;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	bool truncated = false;
+
+	while (c < end && isDigit(*c)) {
+		if (mantissa < mantissaLimit) mantissa = mantissa * 10 + (*c - '0');
+		else {
+			exponent++;
+			truncated = true;
+		}
+		digits++;
+		c++;
+	}
+
+	if (c < end && *c == '.') {
+		c++;
+		while (c < end && isDigit(*c)) {
+			if (mantissa < mantissaLimit) {
+				mantissa = mantissa * 10 + (*c - '0');
+				exponent--;
+			} else {
+				truncated = true;
+			}
+			digits++;
+			c++;
+		}
+	}
+
+	if (digits == 0) return start;
+
+	// Only take the exponent if it has digits, otherwise the 'e' is not part of the number
+	if (c < end && (*c == 'e' || *c == 'E')) {
+		const char *e = c + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+')) {
+			negativeExponent = *e == '-';
+			e++;
+		}
+
+		if (e < end && isDigit(*e)) {
+			int written = 0;
+			while (e < end && isDigit(*e)) {
+				if (written < 100000) written = written * 10 + (*e - '0');
+				e++;
+			}
+			exponent += negativeExponent ? -written : written;
+			c = e;
+		}
+	}
+
+	if (!truncated && mantissa <= (1ull << 24) && exponent >= -10 && exponent <= 10) {
+		float result = float(mantissa);
+		result = exponent < 0 ? result / powersOfTen[-exponent] : result * powersOfTen[exponent];
+		value = negative ? -result : result;
+	} else {
+		std::string text(start, c);
+		value = strtof(text.c_str(), nullptr);
+	}
+
+	return c;
+}
@@ -0,0 +1,128 @@
+//---------------------------------------------------------------------------
+// Shared Worker Thread Pool
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// State of one parallelFor call, shared with the workers helping on it so it
+// outlives the call if a helper only starts once all chunks are taken
+struct parallelJob {
+	function<void(int, int, int)> func;
+	int count;
+	int chunkSize;
+	int chunkCount;
+	atomic<int> nextChunk;
+	atomic<int> chunksDone;
+	mutex doneMutex;
+	condition_variable done;
+
+	// Run chunks until none are left
+	void work() {
+		int chunk;
+		while ((chunk = nextChunk++) < chunkCount) {
+			int begin = chunk * chunkSize;
+			int end = min(count, begin + chunkSize);
+			func(begin, end, chunk);
+
+			if (++chunksDone == chunkCount) {
+				lock_guard<mutex> lock(doneMutex);
+				done.notify_all();
+			}
+		}
+	}
+};
+
+ThreadPool::ThreadPool(int threadCount) {
+	if (threadCount <= 0) threadCount = max(1, int(thread::hardware_concurrency()));
+
+	for (int i = 0; i < threadCount - 1; i++) {
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (thread &worker : workers) {
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
+
+int ThreadPool::getThreadCount() {
+	return workers.size() + 1;
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		function<void()> task;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty()) return;
+
+			task = move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::parallelFor(int count, int chunkSize, const function<void(int, int, int)> &func) {
+	if (count <= 0) return;
+	chunkSize = max(1, chunkSize);
+
+	int chunkCount = (count + chunkSize - 1) / chunkSize;
+
+	// Not worth waking the workers for a single chunk
+	if (chunkCount == 1 || workers.empty()) {
+		for (int chunk = 0; chunk < chunkCount; chunk++) {
+			func(chunk * chunkSize, min(count, (chunk + 1) * chunkSize), chunk);
+		}
+		return;
+	}
+
+	shared_ptr<parallelJob> job = make_shared<parallelJob>();
+	job->func = func;
+	job->count = count;
+	job->chunkSize = chunkSize;
+	job->chunkCount = chunkCount;
+	job->nextChunk = 0;
+	job->chunksDone = 0;
+
+	// Ask as many workers as there are chunks left over for the calling thread
+	int helpers = min(int(workers.size()), chunkCount - 1);
+	{
+		lock_guard<std::mutex> lock(mutex);
+		for (int i = 0; i < helpers; i++) {
+			tasks.push_back([job] { job->work(); });
+		}
+	}
+	wake.notify_all();
+
+	job->work();
+
+	unique_lock<std::mutex> lock(job->doneMutex);
+	job->done.wait(lock, [&job] { return job->chunksDone == job->chunkCount; });
+}
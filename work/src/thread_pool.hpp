@@ -0,0 +1,46 @@
+//---------------------------------------------------------------------------
+// Shared Worker Thread Pool
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+
+	public:
+		// A thread count of 0 uses one worker per hardware thread besides the caller
+		ThreadPool(int threadCount = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Pool shared by every system in the application
+		static ThreadPool& shared();
+
+		// Number of threads work is spread across, including the calling thread
+		int getThreadCount();
+
+		// Split [0, count) into chunks of chunkSize and call func(begin, end, chunkIndex)
+		// for each across the pool. The calling thread takes chunks too, and the call
+		// returns once every chunk is done. Chunk boundaries only depend on count and
+		// chunkSize, so per chunk state such as random seeds is reproducible
+		void parallelFor(int count, int chunkSize, const std::function<void(int, int, int)>&);
+
+	private:
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> tasks;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool stopping = false;
+
+		void workerLoop();
+};
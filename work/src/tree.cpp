@@ -1,9 +1,11 @@
 #include <cmath>
 #include <cstdlib>
+#include <iostream>
 #include <string>
 #include <vector>
 
 #include "cgra_geometry.hpp"
+#include "frustum.hpp"
 #include "fuzzy_object.hpp"
 #include "cgra_math.hpp"
 #include "opengl.hpp"
@@ -30,6 +32,8 @@ Tree::Tree(float height, float trunk, float branchLength, float influenceRatio,
 	generateGeometry(generatedTreeRoot);
 	dummyTreeRoot = makeDummyTree(4); // make dummy tree to work with
 	setAccumulativeValues(generatedTreeRoot, 0, vec3(0,0,0));
+	setSubtreeBounds(generatedTreeRoot);
+	setSubtreeBounds(dummyTreeRoot);
 
 	if(dummyTree){
 		root = dummyTreeRoot;
@@ -162,11 +166,13 @@ void Tree::simplifyGeometry(branch *b){
 }
 
 void Tree::generateGeometry(branch *b) {
-	b->jointModel = generateSphereGeometry(b->baseWidth);
-
+	// Joints and branches are drawn from shared unit primitives, scaled and tapered per branch.
+	// The branch still gets its own cylinder for the fuzzy system to seed particles in, which
+	// is only uploaded if it is ever drawn
 	b->branchModel = generateCylinderGeometry(b->baseWidth, b->topWidth, b->length, 10, 2);
 
-	b->jointModel->setMaterial(m_ambient, m_diffuse, m_specular, m_shininess, m_emission);
+	unitSphereGeometry()->setMaterial(m_ambient, m_diffuse, m_specular, m_shininess, m_emission);
+	unitCylinderGeometry(10, 2)->setMaterial(m_ambient, m_diffuse, m_specular, m_shininess, m_emission);
 	b->branchModel->setMaterial(m_ambient, m_diffuse, m_specular, m_shininess, m_emission);
 
 	b->branchFuzzySystem = new FuzzyObject(b->branchModel);
@@ -421,11 +427,19 @@ void Tree::renderTree(bool wireframe) {
 	//makes sure the tree is drawn at its set position
 	glTranslatef(m_position.x, m_position.y, m_position.z);
 
+	// Find where the shader takes the shape of each branch, if there is a shader
+	GLint program = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	branchShapeLocation = program != 0 ? glGetUniformLocation(program, "branchShape") : -1;
+
+	// Branches are culled against the view in the space of their own base
+	Frustum frustum = Frustum::fromCurrentMatrices();
+
 	//Actually draw the tree
 
 	setAccumulativeValues(root, 0, vec3(0,0,0));
 	updateWorldWindDirection(root, vec3(0,0,0));
-	renderBranch(root, wireframe);
+	renderBranch(root, wireframe, frustum);
 
 	//increment wind "time"
 	time += timeIncrement;
@@ -437,7 +451,7 @@ void Tree::renderTree(bool wireframe) {
 /* performs the logic for drawing any given branch at its position and rotation.
 	then recursively calls renderBranch() on all of its child branches.
 */
-void Tree::renderBranch(branch *b, bool wireframe, int depth) {
+void Tree::renderBranch(branch *b, bool wireframe, const Frustum &frustum, int depth) {
 	if(b == NULL){
 		return;
 	}
@@ -446,6 +460,19 @@ void Tree::renderBranch(branch *b, bool wireframe, int depth) {
 		applyWind(b);
 	}
 
+	// Skip drawing the whole subtree if it is out of view, its wind still has to be kept up to date
+	if (!frustum.intersectsSphere(vec3(0,0,0), b->reach)) {
+		if (windEnabled) {
+			for (branch* c : b->children) {
+				applySubtreeWind(c);
+			}
+		}
+		return;
+	}
+
+	// Transform into the space of the children, matching the matrix calls below
+	mat4 childTransform(1);
+
 	static int i_k =0;
 
 	glPushMatrix();
@@ -463,24 +490,45 @@ void Tree::renderBranch(branch *b, bool wireframe, int depth) {
 			//translate to the end of the branch based off length and direction
 			vec3 offset = b->direction * b->length;
 			glTranslatef(offset.x,offset.y,offset.z);
+
+			childTransform = mat4::rotateZ(radians(b->rotation.z)) * mat4::rotateX(radians(b->rotation.x)) * mat4::translate(offset);
 		}
 
 		//loop through all child branches and render them too
-		for(branch* c : b->children){
-			renderBranch(c, wireframe, depth+1);
+		if (!b->children.empty()) {
+			Frustum childFrustum = frustum.transformed(childTransform);
+			for(branch* c : b->children){
+				renderBranch(c, wireframe, childFrustum, depth+1);
+			}
 		}
 
 	glPopMatrix();
 }
 
 
+/* Finds the radius around the base of each branch that holds it and every branch above it.
+	Wind only rotates branches about their base, so this holds however they are blown about
+*/
+float Tree::setSubtreeBounds(branch *b) {
+	// The joint, the cylinder and the particles overhanging its surface
+	float margin = b->branchFuzzySystem ? b->branchFuzzySystem->getParticleRadius() : 0.0f;
+	b->reach = b->length + b->baseWidth + margin;
+
+	float offset = length(b->direction) * b->length;
+	for (branch* c : b->children) {
+		b->reach = max(b->reach, offset + setSubtreeBounds(c));
+	}
+	return b->reach;
+}
+
 /* draws a joint at the base of every branch the size of the width at the base of the branch
 	this prevents a tree breaking visual issue when rotating branches.
 */
 void Tree::drawJoint(branch* b, bool wireframe){
 	if (!wireframe && !fuzzySystemFinishedBuilding) {
 		glPushMatrix();
-			b->jointModel->renderGeometry(wireframe);
+			glScalef(b->baseWidth, b->baseWidth, b->baseWidth);
+			unitSphereGeometry()->renderGeometry(wireframe);
 		glPopMatrix();
 	}
 }
@@ -497,7 +545,14 @@ void Tree::drawBranch(branch* b, bool wireframe){
 	glPushMatrix();
 		glRotatef(-degrees(angle), crossProd.x, crossProd.y, crossProd.z);
 		if (!fuzzySystemFinishedBuilding){
-			b->branchModel->renderGeometry(wireframe);
+			// Without a shader to taper the shared cylinder the branch draws its own
+			if (branchShapeLocation >= 0) {
+				glUniform3f(branchShapeLocation, b->baseWidth, b->topWidth, b->length);
+				unitCylinderGeometry(10, 2)->renderGeometry(wireframe);
+				glUniform3f(branchShapeLocation, 0, 0, 0);
+			} else {
+				b->branchModel->renderGeometry(wireframe);
+			}
 			if((b->baseWidth < 2 * prm_branchMinWidth) && !wireframe){
 				//drawLeaves(b,leaves);
 			}
@@ -640,6 +695,15 @@ float Tree::springConstant(branch* branch){
 	return k;
 }
 
+/* applies wind to a branch and everything above it without drawing them
+*/
+void Tree::applySubtreeWind(branch* b){
+	applyWind(b);
+	for (branch* c : b->children) {
+		applySubtreeWind(c);
+	}
+}
+
 /*
 	the central method for applying wind force to a branch.
 	calculates the displacement value for the branch based on the wind then
@@ -836,12 +900,35 @@ void Tree::buildFuzzySystems(bool increment) {
 	}
 
 	// Check if the fuzzy systems have finished building
+	if (fuzzySystemFinishedBuilding) return;
 	for (FuzzyObject* fuzzySystem : fuzzyBranchSystems) {
 		if (!fuzzySystem->finishedBuilding()) {
 			return;
 		}
 	}
 	fuzzySystemFinishedBuilding = true;
+
+	// Report how long the branch systems took to converge
+	int totalSteps = 0;
+	int maxSteps = 0;
+	for (FuzzyObject* fuzzySystem : fuzzyBranchSystems) {
+		totalSteps += fuzzySystem->getBuildSteps();
+		maxSteps = max(maxSteps, fuzzySystem->getBuildSteps());
+	}
+	cout << "Tree fuzzy systems built: " << fuzzyBranchSystems.size() << " systems, "
+		<< totalSteps << " total steps, " << maxSteps << " max steps" << endl;
+}
+
+void Tree::setFuzzySeedingMode(seedingMode mode) {
+	for (FuzzyObject* fuzzySystem : fuzzyBranchSystems) {
+		fuzzySystem->setSeedingMode(mode);
+	}
+}
+
+void Tree::setFuzzyRenderMode(particleRenderMode mode) {
+	for (FuzzyObject* fuzzySystem : fuzzyBranchSystems) {
+		fuzzySystem->setRenderMode(mode);
+	}
 }
 
 bool Tree::finishedBuildingFuzzySystems() {
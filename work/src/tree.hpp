@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "geometry.hpp"
+#include "frustum.hpp"
 #include "fuzzy_object.hpp"
 
 struct branch{
@@ -28,6 +29,7 @@ struct branch{
 	float length;					// length of the branch
 	float baseWidth;				// width of the base of the branch
 	float topWidth;					// width of the top of the branch
+	float reach = 0.0f;				// radius around the base holding this branch and all above it
 	float offset;					// used to offset the branches sway in the wind
 
 	branch* parent;
@@ -38,7 +40,6 @@ struct branch{
 	cgra::vec3 rotation = cgra::vec3(0,0,0);          // Rotation of joint in the basis (degrees)
 	cgra::vec3 combinedRotation = cgra::vec3(0,0,0);          // Rotation of joint in the basis (degrees)
 
-	Geometry* jointModel = nullptr;
 	Geometry* branchModel = nullptr;
 	FuzzyObject* branchFuzzySystem = nullptr;
 };
@@ -64,6 +65,8 @@ class Tree{
 
 		// Fuzzy particle system methods
 		void buildFuzzySystems(bool);
+		void setFuzzySeedingMode(seedingMode);
+		void setFuzzyRenderMode(particleRenderMode);
 		bool finishedBuildingFuzzySystems();
 		std::vector<cgra::vec3> getFuzzySystemPoints();
 		int getFuzzySystemParticleCount();
@@ -107,6 +110,9 @@ class Tree{
 		std::vector<FuzzyObject*> fuzzyBranchSystems;
 		bool fuzzySystemFinishedBuilding = false;
 
+		// Location of the shader's branchShape uniform for this frame, -1 without one
+		GLint branchShapeLocation = -1;
+
 		//Tree Generation Methods
 		branch* generateTree();
 		float setWidth(branch*);
@@ -123,10 +129,11 @@ class Tree{
 
 		bool inEnvelope(cgra::vec3);
 		branch* makeDummyTree(int);
+		float setSubtreeBounds(branch*);
 
 
 		//Drawing Methods
-		void renderBranch(branch *b, bool, int depth=0);
+		void renderBranch(branch *b, bool, const Frustum&, int depth=0);
 		void drawBranch(branch*, bool);
 		void drawLeaves(branch*);
 		void drawJoint(branch*, bool);
@@ -152,6 +159,7 @@ class Tree{
 		float calculatePressure(branch*, float, int);
 		float springConstant(branch*);
 		void applyWind(branch*);
+		void applySubtreeWind(branch*);
 
 		void updateWorldWindDirection(branch*, cgra::vec3);
 
@@ -0,0 +1,302 @@
+//---------------------------------------------------------------------------
+// Bounding Volume Hierarchy over Mesh Triangles
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "triangle_bvh.hpp"
+
+using namespace std;
+using namespace cgra;
+
+// Maximum number of triangles stored in a leaf node
+static const int maxLeafSize = 4;
+
+void TriangleBVH::build(const vector<vec3> &corners) {
+	nodes.clear();
+	triIndices.clear();
+	v0.clear();
+	e1.clear();
+	e2.clear();
+
+	int triCount = corners.size() / 3;
+	if (triCount == 0) return;
+
+	// Triangles are partitioned by their centroids
+	vector<vec3> centroids(triCount);
+	for (int i = 0; i < triCount; i++) {
+		centroids[i] = (corners[i * 3] + corners[i * 3 + 1] + corners[i * 3 + 2]) / 3.0f;
+		triIndices.push_back(i);
+	}
+
+	nodes.reserve(triCount * 2 / maxLeafSize + 1);
+	buildNode(triIndices, centroids, corners, 0, triCount);
+
+	// Store the triangle edges in leaf order for the intersection tests
+	v0.resize(triCount);
+	e1.resize(triCount);
+	e2.resize(triCount);
+	for (int i = 0; i < triCount; i++) {
+		int t = triIndices[i];
+		v0[i] = corners[t * 3];
+		e1[i] = corners[t * 3 + 1] - corners[t * 3];
+		e2[i] = corners[t * 3 + 2] - corners[t * 3];
+	}
+}
+
+// Recursively build the node covering triangles [begin, end), splitting at the
+// median centroid along the longest axis. Returns the index of the new node
+int TriangleBVH::buildNode(vector<int> &indices, const vector<vec3> &centroids, const vector<vec3> &corners, int begin, int end) {
+	int nodeIndex = nodes.size();
+	nodes.push_back(bvhNode());
+
+	float inf = numeric_limits<float>::max();
+	vec3 minBounds = vec3(inf, inf, inf);
+	vec3 maxBounds = vec3(-inf, -inf, -inf);
+	vec3 minCentroid = minBounds;
+	vec3 maxCentroid = maxBounds;
+
+	for (int i = begin; i < end; i++) {
+		int t = indices[i];
+		for (int j = 0; j < 3; j++) {
+			minBounds = cgra::min(minBounds, corners[t * 3 + j]);
+			maxBounds = cgra::max(maxBounds, corners[t * 3 + j]);
+		}
+		minCentroid = cgra::min(minCentroid, centroids[t]);
+		maxCentroid = cgra::max(maxCentroid, centroids[t]);
+	}
+
+	nodes[nodeIndex].minBounds = minBounds;
+	nodes[nodeIndex].maxBounds = maxBounds;
+
+	vec3 extent = maxCentroid - minCentroid;
+	if (end - begin <= maxLeafSize || (extent.x <= 0.0f && extent.y <= 0.0f && extent.z <= 0.0f)) {
+		nodes[nodeIndex].start = begin;
+		nodes[nodeIndex].count = end - begin;
+		return nodeIndex;
+	}
+
+	int axis = 0;
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	int mid = (begin + end) / 2;
+	nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, [&](int a, int b) {
+		return centroids[a][axis] < centroids[b][axis];
+	});
+
+	// The left child always directly follows its parent
+	buildNode(indices, centroids, corners, begin, mid);
+	int right = buildNode(indices, centroids, corners, mid, end);
+
+	nodes[nodeIndex].start = right;
+	nodes[nodeIndex].count = 0;
+	return nodeIndex;
+}
+
+bool TriangleBVH::empty() const {
+	return nodes.empty();
+}
+
+// Moller-Trumbore ray triangle test, matching Geometry::rayIntersectsTriangle
+// Returns true and the distance along the ray if an intersection occured
+bool TriangleBVH::intersectTriangle(int i, vec3 p, vec3 d, float &t) const {
+	vec3 h = cross(d, e2[i]);
+	float a = dot(e1[i], h);
+
+	if (a > -0.00001f && a < 0.00001f) return false;
+
+	float f = 1 / a;
+	vec3 s = p - v0[i];
+	float u = f * dot(s, h);
+
+	if (u < 0.0f || u > 1.0f) return false;
+
+	vec3 q = cross(s, e1[i]);
+	float v = f * dot(d, q);
+
+	if (v < 0.0f || u + v > 1.0f) return false;
+
+	t = f * dot(e2[i], q);
+	return t > 0.00001f;
+}
+
+// Slab test of the ray against a node's bounds, limited to distances less than maxT
+bool TriangleBVH::rayHitsBox(const bvhNode &node, vec3 p, vec3 invD, float maxT) const {
+	float tMin = 0.0f;
+	float tMax = maxT;
+
+	for (int axis = 0; axis < 3; axis++) {
+		float t1 = (node.minBounds[axis] - p[axis]) * invD[axis];
+		float t2 = (node.maxBounds[axis] - p[axis]) * invD[axis];
+
+		// A ray parallel to the slab and starting on its plane produces NaNs, treat it as inside
+		if (t1 != t1 || t2 != t2) continue;
+
+		tMin = std::max(tMin, std::min(t1, t2));
+		tMax = std::min(tMax, std::max(t1, t2));
+	}
+
+	return tMin <= tMax;
+}
+
+int TriangleBVH::raycast(vec3 p, vec3 d, vec3 &hitPoint) const {
+	if (nodes.empty()) return -1;
+
+	vec3 invD = vec3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+	float closestT = numeric_limits<float>::max();
+	int closest = -1;
+
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		int nodeIndex = stack[--stackSize];
+		const bvhNode &node = nodes[nodeIndex];
+
+		if (!rayHitsBox(node, p, invD, closestT)) continue;
+
+		if (node.count > 0) {
+			for (int i = node.start; i < node.start + node.count; i++) {
+				float t;
+				if (intersectTriangle(i, p, d, t) && t < closestT) {
+					closestT = t;
+					closest = triIndices[i];
+				}
+			}
+		} else {
+			stack[stackSize++] = node.start;
+			stack[stackSize++] = nodeIndex + 1;
+		}
+	}
+
+	if (closest >= 0) hitPoint = p + d * closestT;
+	return closest;
+}
+
+int TriangleBVH::countCrossings(vec3 p, vec3 d) const {
+	if (nodes.empty()) return 0;
+
+	vec3 invD = vec3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+	float maxT = numeric_limits<float>::max();
+	int crossings = 0;
+
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		int nodeIndex = stack[--stackSize];
+		const bvhNode &node = nodes[nodeIndex];
+
+		if (!rayHitsBox(node, p, invD, maxT)) continue;
+
+		if (node.count > 0) {
+			for (int i = node.start; i < node.start + node.count; i++) {
+				float t;
+				if (intersectTriangle(i, p, d, t)) crossings++;
+			}
+		} else {
+			stack[stackSize++] = node.start;
+			stack[stackSize++] = nodeIndex + 1;
+		}
+	}
+
+	return crossings;
+}
+
+// Squared distance from the point to a node's bounds, 0 if the point is inside them
+float TriangleBVH::boxDistanceSq(const bvhNode &node, vec3 p) const {
+	vec3 d = cgra::max(cgra::max(node.minBounds - p, p - node.maxBounds), 0.0f);
+	return dot(d, d);
+}
+
+// Squared distance from the point to the closest point on a triangle
+// Real-Time Collision Detection, Christer Ericson, section 5.1.5
+float TriangleBVH::triangleDistanceSq(int i, vec3 p) const {
+	vec3 a = v0[i];
+	vec3 ab = e1[i];
+	vec3 ac = e2[i];
+	vec3 closest;
+
+	vec3 ap = p - a;
+	float d1 = dot(ab, ap);
+	float d2 = dot(ac, ap);
+
+	vec3 bp = p - (a + ab);
+	float d3 = dot(ab, bp);
+	float d4 = dot(ac, bp);
+
+	vec3 cp = p - (a + ac);
+	float d5 = dot(ab, cp);
+	float d6 = dot(ac, cp);
+
+	float va = d3 * d6 - d5 * d4;
+	float vb = d5 * d2 - d1 * d6;
+	float vc = d1 * d4 - d3 * d2;
+
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		closest = a; // Vertex region A
+	} else if (d3 >= 0.0f && d4 <= d3) {
+		closest = a + ab; // Vertex region B
+	} else if (d6 >= 0.0f && d5 <= d6) {
+		closest = a + ac; // Vertex region C
+	} else if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		closest = a + ab * (d1 / (d1 - d3)); // Edge region AB
+	} else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		closest = a + ac * (d2 / (d2 - d6)); // Edge region AC
+	} else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		closest = a + ab + (ac - ab) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))); // Edge region BC
+	} else {
+		// Face region
+		float denom = 1.0f / (va + vb + vc);
+		closest = a + ab * (vb * denom) + ac * (vc * denom);
+	}
+
+	vec3 d = p - closest;
+	return dot(d, d);
+}
+
+float TriangleBVH::closestDistance(vec3 p) const {
+	if (nodes.empty()) return numeric_limits<float>::max();
+
+	float bestSq = numeric_limits<float>::max();
+
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		int nodeIndex = stack[--stackSize];
+		const bvhNode &node = nodes[nodeIndex];
+
+		if (boxDistanceSq(node, p) >= bestSq) continue;
+
+		if (node.count > 0) {
+			for (int i = node.start; i < node.start + node.count; i++) {
+				bestSq = std::min(bestSq, triangleDistanceSq(i, p));
+			}
+		} else {
+
+			// Visit the nearer child first so the further one is more likely to be pruned
+			int left = nodeIndex + 1;
+			int right = node.start;
+			if (boxDistanceSq(nodes[left], p) < boxDistanceSq(nodes[right], p)) {
+				stack[stackSize++] = right;
+				stack[stackSize++] = left;
+			} else {
+				stack[stackSize++] = left;
+				stack[stackSize++] = right;
+			}
+		}
+	}
+
+	return sqrt(bestSq);
+}
@@ -0,0 +1,50 @@
+//---------------------------------------------------------------------------
+// Bounding Volume Hierarchy over Mesh Triangles
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include "cgra_math.hpp"
+
+struct bvhNode {
+	cgra::vec3 minBounds;
+	cgra::vec3 maxBounds;
+	int start = 0; // First triangle of a leaf, or the right child of an interior node
+	int count = 0; // Number of triangles in a leaf, 0 for interior nodes
+};
+
+class TriangleBVH {
+
+	public:
+		// Build the hierarchy from a list of triangle corners, 3 per triangle
+		void build(const std::vector<cgra::vec3>&);
+		bool empty() const;
+
+		// Returns the index of the closest triangle hit by the ray or -1, along with the hit point
+		int raycast(cgra::vec3, cgra::vec3, cgra::vec3&) const;
+
+		// Returns the number of triangles crossed by the ray
+		int countCrossings(cgra::vec3, cgra::vec3) const;
+
+		// Returns the distance from the point to the closest point on any triangle
+		float closestDistance(cgra::vec3) const;
+
+	private:
+		std::vector<bvhNode> nodes;
+
+		// Triangle data reordered so each leaf references a contiguous range
+		std::vector<int> triIndices;
+		std::vector<cgra::vec3> v0;
+		std::vector<cgra::vec3> e1;
+		std::vector<cgra::vec3> e2;
+
+		int buildNode(std::vector<int>&, const std::vector<cgra::vec3>&, const std::vector<cgra::vec3>&, int, int);
+		bool intersectTriangle(int, cgra::vec3, cgra::vec3, float&) const;
+		bool rayHitsBox(const bvhNode&, cgra::vec3, cgra::vec3, float) const;
+		float boxDistanceSq(const bvhNode&, cgra::vec3) const;
+		float triangleDistanceSq(int, cgra::vec3) const;
+};
@@ -0,0 +1,52 @@
+//---------------------------------------------------------------------------
+// Lock Free Triple Buffer
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+
+// Hands values from one writer thread to one reader thread without either
+// waiting on the other. The writer fills the back slot and publishes it, the
+// reader picks up the most recently published slot whenever it wants. Slots
+// are only ever swapped, so neither side touches a slot the other is using
+template <typename T>
+class TripleBuffer {
+
+	public:
+		// Slot owned by the writer, to be filled before calling publish
+		T& back() {
+			return slots[backIndex];
+		}
+
+		// Make the back slot the latest value, taking the previous latest slot as the new back slot
+		void publish() {
+			int previous = ready.exchange(backIndex | freshBit, std::memory_order_acq_rel);
+			backIndex = previous & indexMask;
+		}
+
+		// Swap in the latest published value if there is a new one, returns true if so
+		bool acquire() {
+			if (!(ready.load(std::memory_order_acquire) & freshBit)) return false;
+
+			int previous = ready.exchange(frontIndex, std::memory_order_acq_rel);
+			frontIndex = previous & indexMask;
+			return true;
+		}
+
+		// Slot owned by the reader, the value as of the last acquire
+		const T& front() const {
+			return slots[frontIndex];
+		}
+
+	private:
+		static const int indexMask = 3;
+		static const int freshBit = 4;
+
+		T slots[3];
+		int backIndex = 0;
+		int frontIndex = 1;
+		std::atomic<int> ready { 2 }; // Slot index in between the two, with freshBit set once published
+};
@@ -0,0 +1,162 @@
+//---------------------------------------------------------------------------
+// Post Transform Vertex Cache Optimisation
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "vertex_cache.hpp"
+
+using namespace std;
+
+// Size of the simulated LRU cache used for scoring, larger than most real caches
+static const int cacheSize = 32;
+
+// Scoring constants from Forsyth's paper
+static const float cacheDecayPower = 1.5f;
+static const float lastTriangleScore = 0.75f;
+static const float valenceBoostScale = 2.0f;
+static const float valenceBoostPower = 0.5f;
+
+// Valence scores are looked up for vertices with up to this many triangles left
+static const int maxValence = 64;
+
+// Score of a vertex given where it is in the cache and how many triangles still use it
+static float vertexScore(int cachePosition, int remaining, const float *cacheScores, const float *valenceScores) {
+	if (remaining == 0) return -1.0f;
+
+	float score = cachePosition < 0 ? 0.0f : cacheScores[cachePosition];
+	return score + (remaining < maxValence ? valenceScores[remaining] : valenceBoostScale * pow(float(remaining), -valenceBoostPower));
+}
+
+void optimizeVertexCache(vector<uint32_t> &indices, int vertexCount) {
+	int triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || vertexCount <= 0) return;
+
+	// The three most recent vertices get a fixed score so the next triangle does not
+	// simply reuse the last one, the rest decay with their position in the cache
+	float cacheScores[cacheSize];
+	for (int i = 0; i < cacheSize; i++) {
+		if (i < 3) {
+			cacheScores[i] = lastTriangleScore;
+		} else {
+			cacheScores[i] = pow(1.0f - float(i - 3) / (cacheSize - 3), cacheDecayPower);
+		}
+	}
+
+	// Vertices with few triangles left are boosted so they get finished off
+	float valenceScores[maxValence];
+	valenceScores[0] = 0.0f;
+	for (int i = 1; i < maxValence; i++) {
+		valenceScores[i] = valenceBoostScale * pow(float(i), -valenceBoostPower);
+	}
+
+	// Triangles using each vertex, stored as one array indexed by running totals
+	vector<int> remaining(vertexCount, 0);
+	for (uint32_t index : indices) {
+		remaining[index]++;
+	}
+
+	vector<int> firstTriangle(vertexCount + 1, 0);
+	for (int i = 0; i < vertexCount; i++) {
+		firstTriangle[i + 1] = firstTriangle[i] + remaining[i];
+	}
+
+	vector<int> vertexTriangles(indices.size());
+	vector<int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (int i = 0; i < triangleCount * 3; i++) {
+		vertexTriangles[filled[indices[i]]++] = i / 3;
+	}
+
+	vector<int> cachePosition(vertexCount, -1);
+	vector<float> scores(vertexCount);
+	for (int i = 0; i < vertexCount; i++) {
+		scores[i] = vertexScore(-1, remaining[i], cacheScores, valenceScores);
+	}
+
+	vector<float> triangleScores(triangleCount);
+	for (int i = 0; i < triangleCount; i++) {
+		triangleScores[i] = scores[indices[i * 3]] + scores[indices[i * 3 + 1]] + scores[indices[i * 3 + 2]];
+	}
+
+	vector<bool> emitted(triangleCount, false);
+	vector<uint32_t> ordered;
+	ordered.reserve(indices.size());
+
+	// Room for the cache plus the three vertices pushed in front of it by each triangle
+	int cache[cacheSize + 3];
+	int cacheUsed = 0;
+
+	// Start from the best triangle overall, after that only triangles touching the cache
+	// are considered, falling back to the next unused triangle when none of them are left
+	int bestTriangle = max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin();
+	int nextUnused = 0;
+
+	while (bestTriangle >= 0) {
+		emitted[bestTriangle] = true;
+
+		int newCache[cacheSize + 3];
+		int newCacheUsed = 0;
+
+		for (int j = 0; j < 3; j++) {
+			uint32_t v = indices[bestTriangle * 3 + j];
+			ordered.push_back(v);
+			newCache[newCacheUsed++] = v;
+
+			// Remove the triangle from the vertex's list of remaining triangles
+			int *begin = &vertexTriangles[firstTriangle[v]];
+			int *end = begin + remaining[v];
+			*find(begin, end, bestTriangle) = *(end - 1);
+			remaining[v]--;
+		}
+
+		// Older cache entries move back behind the triangle's vertices
+		for (int i = 0; i < cacheUsed; i++) {
+			int v = cache[i];
+			if (v != newCache[0] && v != newCache[1] && v != newCache[2]) newCache[newCacheUsed++] = v;
+		}
+
+		// Rescore everything in the cache, including entries that just fell out of it
+		for (int i = 0; i < newCacheUsed; i++) {
+			int v = newCache[i];
+			cachePosition[v] = i < cacheSize ? i : -1;
+			float score = vertexScore(cachePosition[v], remaining[v], cacheScores, valenceScores);
+			float change = score - scores[v];
+			scores[v] = score;
+
+			for (int k = firstTriangle[v]; k < firstTriangle[v] + remaining[v]; k++) {
+				triangleScores[vertexTriangles[k]] += change;
+			}
+		}
+
+		cacheUsed = min(newCacheUsed, cacheSize);
+		for (int i = 0; i < cacheUsed; i++) {
+			cache[i] = newCache[i];
+		}
+
+		// Pick the best remaining triangle that uses a cached vertex
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (int i = 0; i < cacheUsed; i++) {
+			int v = cache[i];
+			for (int k = firstTriangle[v]; k < firstTriangle[v] + remaining[v]; k++) {
+				int t = vertexTriangles[k];
+				if (triangleScores[t] > bestScore) {
+					bestScore = triangleScores[t];
+					bestTriangle = t;
+				}
+			}
+		}
+
+		if (bestTriangle < 0) {
+			while (nextUnused < triangleCount && emitted[nextUnused]) nextUnused++;
+			if (nextUnused < triangleCount) bestTriangle = nextUnused;
+		}
+	}
+
+	indices.swap(ordered);
+}
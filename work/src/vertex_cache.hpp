@@ -0,0 +1,16 @@
+//---------------------------------------------------------------------------
+// Post Transform Vertex Cache Optimisation
+//
+// By Jack Purvis
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Reorder the triangles of an index buffer, 3 indices per triangle, so vertices
+// shared between triangles are drawn close together and are still in the GPU's
+// post transform cache when they are used again. Uses Tom Forsyth's linear speed
+// greedy algorithm, which does not depend on the exact size of the hardware cache
+void optimizeVertexCache(std::vector<uint32_t>&, int vertexCount);